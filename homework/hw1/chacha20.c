@@ -0,0 +1,266 @@
+#include<stdint.h>
+#include<string.h>
+#include "chacha20.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define CHACHA_X86 1
+#endif
+
+#define ROTL32(v, n)    (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QR(a, b, c, d) do {                             \
+    a += b; d ^= a; d = ROTL32(d, 16);                  \
+    c += d; b ^= c; b = ROTL32(b, 12);                  \
+    a += b; d ^= a; d = ROTL32(d, 8);                   \
+    c += d; b ^= c; b = ROTL32(b, 7);                   \
+} while (0)
+
+static void chacha_scalar(const struct chacha *c, uint64_t first,
+                          size_t blocks, uint8_t *out);
+
+chacha_fn_t chacha_blocks = chacha_scalar;
+
+static uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+void chacha_setup(struct chacha *c, const uint8_t *key, const uint8_t *nonce) {
+    static const uint8_t zero[CHACHA_NONCE_SIZE];
+    int i;
+
+    c->state[0] = 0x61707865;       //"expand 32-byte k"
+    c->state[1] = 0x3320646e;
+    c->state[2] = 0x79622d32;
+    c->state[3] = 0x6b206574;
+    for (i = 0; i < 8; i++)
+        c->state[4 + i] = load32(key + 4 * i);
+    c->state[12] = c->state[13] = 0;
+    if (!nonce)
+        nonce = zero;
+    c->state[14] = load32(nonce);
+    c->state[15] = load32(nonce + 4);
+}
+
+/*Scalar fallback - one block at a time*/
+static void chacha_scalar(const struct chacha *c, uint64_t first,
+                          size_t blocks, uint8_t *out) {
+    uint32_t x[16], s[16];
+    size_t n;
+    int i;
+
+    memcpy(s, c->state, sizeof(s));
+    for (n = 0; n < blocks; n++, out += CHACHA_BLOCK) {
+        s[12] = (uint32_t)(first + n);
+        s[13] = (uint32_t)((first + n) >> 32);
+        memcpy(x, s, sizeof(x));
+        for (i = 0; i < 10; i++) {
+            QR(x[0], x[4], x[8],  x[12]);
+            QR(x[1], x[5], x[9],  x[13]);
+            QR(x[2], x[6], x[10], x[14]);
+            QR(x[3], x[7], x[11], x[15]);
+            QR(x[0], x[5], x[10], x[15]);
+            QR(x[1], x[6], x[11], x[12]);
+            QR(x[2], x[7], x[8],  x[13]);
+            QR(x[3], x[4], x[9],  x[14]);
+        }
+        for (i = 0; i < 16; i++)
+            store32(out + 4 * i, x[i] + s[i]);
+    }
+}
+
+static int always(void) {
+    return 1;
+}
+
+#ifdef CHACHA_X86
+
+/*
+ * The vector kernels run one block per lane: vector i holds word i of
+ * width consecutive blocks. lanes[] is that layout spilled to memory, and
+ * is turned back into width whole blocks here.
+ */
+static void scatter(const uint32_t *lanes, size_t width, uint8_t *out) {
+    size_t i, j;
+
+    for (j = 0; j < width; j++)
+        for (i = 0; i < 16; i++)
+            store32(out + j * CHACHA_BLOCK + 4 * i, lanes[i * width + j]);
+}
+
+//block counters of width consecutive blocks, split into low and high words
+static void counters(uint64_t first, size_t width, uint32_t *lo, uint32_t *hi) {
+    size_t j;
+
+    for (j = 0; j < width; j++) {
+        lo[j] = (uint32_t)(first + j);
+        hi[j] = (uint32_t)((first + j) >> 32);
+    }
+}
+
+#define ROUNDS(QRV, x) do {                             \
+    int r_;                                             \
+    for (r_ = 0; r_ < 10; r_++) {                       \
+        QRV(x[0], x[4], x[8],  x[12]);                  \
+        QRV(x[1], x[5], x[9],  x[13]);                  \
+        QRV(x[2], x[6], x[10], x[14]);                  \
+        QRV(x[3], x[7], x[11], x[15]);                  \
+        QRV(x[0], x[5], x[10], x[15]);                  \
+        QRV(x[1], x[6], x[11], x[12]);                  \
+        QRV(x[2], x[7], x[8],  x[13]);                  \
+        QRV(x[3], x[4], x[9],  x[14]);                  \
+    }                                                   \
+} while (0)
+
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define QR128(a, b, c, d) do {                                                      \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 16);           \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12);           \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8);            \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7);            \
+} while (0)
+
+__attribute__((target("sse2")))
+static void chacha_sse2(const struct chacha *c, uint64_t first,
+                        size_t blocks, uint8_t *out) {
+    uint32_t lanes[16 * 4] __attribute__((aligned(16)));
+    uint32_t lo[4], hi[4];
+    __m128i x[16], s[16];
+    size_t n;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        s[i] = _mm_set1_epi32((int)c->state[i]);
+    for (n = 0; n + 4 <= blocks; n += 4) {
+        counters(first + n, 4, lo, hi);
+        s[12] = _mm_loadu_si128((const __m128i *)lo);
+        s[13] = _mm_loadu_si128((const __m128i *)hi);
+        memcpy(x, s, sizeof(x));
+        ROUNDS(QR128, x);
+        for (i = 0; i < 16; i++)
+            _mm_store_si128((__m128i *)(lanes + 4 * i), _mm_add_epi32(x[i], s[i]));
+        scatter(lanes, 4, out + n * CHACHA_BLOCK);
+    }
+    chacha_scalar(c, first + n, blocks - n, out + n * CHACHA_BLOCK);
+}
+
+//rotations by whole bytes are a single shuffle
+#define ROT16_256 _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, \
+                                   2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13)
+#define ROT8_256  _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14, \
+                                   3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14)
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define QR256(a, b, c, d) do {                                                          \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);                             \
+    d = _mm256_shuffle_epi8(d, ROT16_256);                                              \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 12);         \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);                             \
+    d = _mm256_shuffle_epi8(d, ROT8_256);                                               \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 7);          \
+} while (0)
+
+__attribute__((target("avx2")))
+static void chacha_avx2(const struct chacha *c, uint64_t first,
+                        size_t blocks, uint8_t *out) {
+    uint32_t lanes[16 * 8] __attribute__((aligned(32)));
+    uint32_t lo[8], hi[8];
+    __m256i x[16], s[16];
+    size_t n;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        s[i] = _mm256_set1_epi32((int)c->state[i]);
+    for (n = 0; n + 8 <= blocks; n += 8) {
+        counters(first + n, 8, lo, hi);
+        s[12] = _mm256_loadu_si256((const __m256i *)lo);
+        s[13] = _mm256_loadu_si256((const __m256i *)hi);
+        memcpy(x, s, sizeof(x));
+        ROUNDS(QR256, x);
+        for (i = 0; i < 16; i++)
+            _mm256_store_si256((__m256i *)(lanes + 8 * i), _mm256_add_epi32(x[i], s[i]));
+        scatter(lanes, 8, out + n * CHACHA_BLOCK);
+    }
+    chacha_sse2(c, first + n, blocks - n, out + n * CHACHA_BLOCK);
+}
+
+#define QR512(a, b, c, d) do {                                                          \
+    a = _mm512_add_epi32(a, b); d = _mm512_xor_si512(d, a); d = _mm512_rol_epi32(d, 16);\
+    c = _mm512_add_epi32(c, d); b = _mm512_xor_si512(b, c); b = _mm512_rol_epi32(b, 12);\
+    a = _mm512_add_epi32(a, b); d = _mm512_xor_si512(d, a); d = _mm512_rol_epi32(d, 8); \
+    c = _mm512_add_epi32(c, d); b = _mm512_xor_si512(b, c); b = _mm512_rol_epi32(b, 7); \
+} while (0)
+
+__attribute__((target("avx512f")))
+static void chacha_avx512(const struct chacha *c, uint64_t first,
+                          size_t blocks, uint8_t *out) {
+    uint32_t lanes[16 * 16] __attribute__((aligned(64)));
+    uint32_t lo[16], hi[16];
+    __m512i x[16], s[16];
+    size_t n;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        s[i] = _mm512_set1_epi32((int)c->state[i]);
+    for (n = 0; n + 16 <= blocks; n += 16) {
+        counters(first + n, 16, lo, hi);
+        s[12] = _mm512_loadu_si512(lo);
+        s[13] = _mm512_loadu_si512(hi);
+        memcpy(x, s, sizeof(x));
+        ROUNDS(QR512, x);
+        for (i = 0; i < 16; i++)
+            _mm512_store_si512(lanes + 16 * i, _mm512_add_epi32(x[i], s[i]));
+        scatter(lanes, 16, out + n * CHACHA_BLOCK);
+    }
+    chacha_scalar(c, first + n, blocks - n, out + n * CHACHA_BLOCK);
+}
+
+static int has_sse2(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+static int has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static int has_avx512(void) {
+    return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+const struct chacha_kernel chacha_kernels[] = {
+#ifdef CHACHA_X86
+    { "avx512", chacha_avx512, has_avx512 },
+    { "avx2",   chacha_avx2,   has_avx2 },
+    { "sse2",   chacha_sse2,   has_sse2 },
+#endif
+    { "scalar", chacha_scalar, always },
+};
+
+const int chacha_kernels_num = sizeof(chacha_kernels) / sizeof(chacha_kernels[0]);
+
+const struct chacha_kernel *chacha_init(void) {
+    int i;
+
+#ifdef CHACHA_X86
+    __builtin_cpu_init();
+#endif
+    for (i = 0; i < chacha_kernels_num; i++) {
+        if (chacha_kernels[i].supported()) {
+            chacha_blocks = chacha_kernels[i].fn;
+            return &chacha_kernels[i];
+        }
+    }
+    //unreachable - scalar is always supported
+    return &chacha_kernels[chacha_kernels_num - 1];
+}
@@ -0,0 +1,41 @@
+#ifndef CHACHA20_H
+#define CHACHA20_H
+
+#include<stddef.h>
+#include<stdint.h>
+
+#define CHACHA_KEY_SIZE     32
+#define CHACHA_NONCE_SIZE   8
+#define CHACHA_BLOCK        64      //keystream bytes per block
+
+/* ChaCha20 with the original 64-bit block counter and 64-bit nonce, so the
+ * keystream byte at offset off lives in block off / CHACHA_BLOCK - any part
+ * of it can be generated without the parts before it. */
+struct chacha {
+    uint32_t state[16];             //constants, key, counter (unused), nonce
+};
+
+/* out receives blocks keystream blocks, starting at block number first */
+typedef void (*chacha_fn_t)(const struct chacha *c, uint64_t first,
+                            size_t blocks, uint8_t *out);
+
+struct chacha_kernel {
+    const char  *name;
+    chacha_fn_t fn;
+    int         (*supported)(void); //runtime CPU check
+};
+
+/* all kernels compiled in, ordered from the widest to the scalar one */
+extern const struct chacha_kernel chacha_kernels[];
+extern const int chacha_kernels_num;
+
+/* kernel used by chacha_blocks() - set by chacha_init() */
+extern chacha_fn_t chacha_blocks;
+
+/* loads the key and nonce (nonce may be NULL for all zeroes) */
+void chacha_setup(struct chacha *c, const uint8_t *key, const uint8_t *nonce);
+
+/* picks the widest kernel this CPU supports and returns it */
+const struct chacha_kernel *chacha_init(void);
+
+#endif
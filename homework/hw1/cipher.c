@@ -9,209 +9,3325 @@
 #include<string.h>
 #include<errno.h>
 #include<dirent.h>
+#include<limits.h>
+#include<sys/mman.h>
+#include<getopt.h>
+#include<pthread.h>
+#include<time.h>
+#include<poll.h>
+#include<signal.h>
+#include<sys/inotify.h>
+#include<sys/signalfd.h>
+#include "xor_kernel.h"
+#include "uring.h"
+#include "walk.h"
+#include "manifest.h"
+#include "spsc.h"
+#include "chacha20.h"
+#include "crc32c.h"
+#include "pack.h"
+#include "range.h"
+#include "stats.h"
 
-#define BUF_SIZE 512
+#define DEF_BUF_SIZE    (64 * 1024)    //data block - large enough for SIMD XOR to pay off
+#define STREAM_BUF_SIZE (1024 * 1024)  //data block when streaming through '-'
+#define PIPE_SIZE       (1024 * 1024)  //requested capacity of stdin/stdout pipes
+#define DIRECT_ALIGN    4096           //O_DIRECT offset/length/buffer alignment
+#define DIRECT_BUF_SIZE (1UL << 20)    //--direct block bounds (and default)
+#define DIRECT_BUF_MAX  (16UL << 20)
+#define MIN_BUF_SIZE    512
+#define MAX_BUF_SIZE    (256UL << 20)
+#define CACHE_LINE      64
+#define MMAP_WINDOW     (1UL << 30)    //address-space budget per mapping in --mmap mode
+#define MAX_JOBS        1024
+#define MAX_TASKS       1024           //-j: tasks in flight before the walk waits
+#define BATCH_FILES     32             //-j: small files handed out as one task
+#define BATCH_BYTES     (1UL << 20)    //   ...or fewer, once their sizes (known with -i) add up to this
+#define DEF_CHUNK_SIZE  (8UL << 20)    //unit of work when a file is split across threads
+#define DEF_CHUNK_MIN   (64UL << 20)   //files from this size on are split into chunks
+#define URING_DEPTH     32             //files in flight in --uring mode
+#define URING_NO_RING   2              //encrypt_dir_uring(): ring unavailable, nothing done
+#define PIPE_DEPTH      8              //blocks in flight per --pipeline file (<= SPSC_CAP)
+#define PIPE_MIN_BLOCKS 4              //smaller files aren't worth two extra threads
+#define WATCH_MASK      (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_EXCL_UNLINK)
+#define WATCH_BUF       (256 * 1024)   //inotify events read at once
+#define WATCH_SEEN      16384          //coalescing table (power of two)
+#define WATCH_BUSY      65536          //in-flight table (power of two, > 2 * MAX_TASKS * BATCH_FILES)
+#define MIN(x, y)       (((x) < (y)) ? (x) : (y))
+#define PR_FILE_ERR(msg, f) printf("ERROR: " msg " [%s/%s]\n" \
+                                   "Cause: %s [%d]\n", \
+                                   (f)->dir_path, (f)->name, strerror(errno), errno)
+
+/* command line options */
+struct options {
+    int use_mmap;               //--mmap: encrypt mapping to mapping
+    int jobs;                   //-j: number of worker threads
+    size_t chunk_size;          //--chunk-size: bytes per chunk of a split file
+    size_t chunk_min;           //--chunk-threshold: smallest file that is split
+    int use_uring;              //--uring: batched async I/O engine
+    int recursive;              //-r: descend into subdirectories
+    int incremental;            //-i: only encrypt sources changed since the last run
+    size_t buf_size;            //-b: bytes per read/XOR/write block (0: engine default)
+    char *latency_log;          //--latency-log: per-file latencies go here
+    int streaming;              //'-' as source or target: one stdin/stdout stream
+    int pipeline;               //--pipeline: read, XOR and write on separate threads
+    int direct;                 //--direct: bypass the page cache
+    int chacha;                 //--chacha: the key file is a ChaCha20 seed
+    int checksum;               //--checksum (and -i): record CRC32Cs in the manifest
+    int verify;                 //--verify: check a target dir against its manifest
+    int pack;                   //--pack: encrypt the tree into one archive
+    int unpack;                 //--unpack: decrypt every file of an archive
+    char *extract;              //--extract: decrypt this one file of an archive
+    char *range;                //--range: decrypt a byte range of this target
+    int watch;                  //--watch: keep encrypting files as they land
+    int stats;                  //--stats json: per-file phase timings on stderr
+};
+
+static struct options opts = {
+    .jobs = 1,
+    .chunk_size = DEF_CHUNK_SIZE,
+    .chunk_min = DEF_CHUNK_MIN,
+};
+
+/* sources encrypted by earlier runs (only with -i / --checksum) */
+static struct manifest *manifest;
+
+/* per-file records and run totals (only with --stats) */
+static struct stats *run_stats;
+
+/* one line (microseconds) per encrypted file (only with --latency-log) */
+static FILE *latency_log;
+
+static const mode_t RO = S_IRUSR | S_IRGRP | S_IROTH;
+static const mode_t RW = S_IRWXU | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 
 /*Resources Declerations */
 struct file {
-    char   *path;               //path to file
+    const char *dir_path;       //directory of the file (for messages)
+    const char *name;           //entry name, relative to the dir fd
     int    id;                  //file descriptor
-    struct stat stats;                  //file descriptor
-    char   buf[BUF_SIZE];       
+    struct stat stats;
+    char   *buf;                //opts.buf_size bytes
+    uint32_t crc;               //CRC32C of the data so far (with opts.checksum)
+    struct file_trace trace;    //--stats: where the file's time went (kept on src)
+};
+
+/* key material - loaded once per run and shared read-only */
+struct key {
+    char   *path;               //path to key file
+    int    id;                  //file descriptor
+    struct stat stats;
+    char   *data;               //whole key (mapped or read into memory) - while loading
+    size_t size;
+    int    mapped;              //data came from mmap (vs. malloc)
+    char   *tile;               //the key repeated, so any block-sized slice is contiguous
+    size_t tile_size;           //multiple of opts.buf_size, >= size + opts.buf_size
+    struct chacha chacha;       //--chacha: generates the key bytes instead of the tile
+    int    seeded;              //chacha and its scratch buffers are set up
+};
+
+/* cyclic cursor over the key - one per file being encrypted */
+struct key_stream {
+    const struct key *key;
+    size_t off;                 //next key byte to hand out (file offset with --chacha)
+};
+
+/* --chacha: per-thread buffer the keystream is generated into */
+static pthread_key_t chacha_scratch;
+
+/* a directory entry waiting for a worker */
+struct job {
+    struct dir_node *dir;       //holds a reference
+    char            name[NAME_MAX + 1];
+    off_t           size;       //as stat'ed by -i's check, else -1 (the worker stats it)
+};
+
+/* a file split into chunk tasks - whoever finishes its last chunk closes it */
+struct big_file {
+    struct dir_node *dir;       //holds a reference
+    char        name[NAME_MAX + 1];
+    char        rel[PATH_MAX];  //manifest path
+    struct file src;            //ids and stats only - chunks use the worker's buffer
+    struct file tgt;
+    size_t      chunks;
+    size_t      left;           //chunks not finished yet
+    int         rc;             //a chunk failed
+    uint32_t    (*crcs)[2];     //plain/cipher CRC of every chunk (with opts.checksum)
+    long long   start;          //usec, for --latency-log
+    long long   start_ns;       //for --stats
+    struct pool *pool;          //--watch: leaves the in-flight set when freed
+};
+
+/* unit of work of the -j scheduler */
+enum task_type {
+    TASK_FILES,                 //a batch of small files, encrypted one after the other
+    TASK_CHUNK                  //one chunk of a big file
+};
+
+struct task {
+    enum task_type  type;
+    struct big_file *big;       //TASK_CHUNK
+    size_t          index;      //TASK_CHUNK: chunk number
+    int             count;      //TASK_FILES: entries in jobs
+    struct job      jobs[];     //TASK_FILES: BATCH_FILES of them
+};
+
+/* per-worker deque. the owner pushes and pops at the bottom (newest first,
+ * while its data is still cached), thieves take the oldest from the top */
+struct deque {
+    struct task     **tasks;    //ring of cap entries
+    size_t          cap;
+    size_t          top;        //index of the oldest task
+    size_t          count;
+    pthread_mutex_t lock;
+};
+
+/* --watch: a file queued or being encrypted. written again meanwhile, it
+ * is marked dirty and queued once more when done, rather than right away -
+ * two workers would truncate and write the same target at once */
+struct busy_file {
+    char            *rel;       //NULL: free slot
+    uint32_t        hash;
+    int             dirty;
+};
+
+/* state shared by all workers of a run */
+struct pool {
+    struct worker   *workers;
+    int             num;
+    struct key      *key;
+    size_t          queued;     //tasks sitting in deques
+    size_t          pending;    //tasks queued or running
+    int             closed;     //the walk is over - only workers add tasks now
+    int             stop;       //fatal error - workers should bail out
+    pthread_mutex_t lock;
+    pthread_cond_t  work;       //a task was queued, or the run is over
+    pthread_cond_t  room;       //pending dropped below MAX_TASKS
+    int             ready;      //workers set up
+    int             started;    //worker threads running
+    struct task     *batch;     //being filled by pool_add()
+    size_t          bytes;      //in batch
+    size_t          next;       //worker whose deque gets the next batch
+    long long       start;      //usec, for the utilization report
+    struct busy_file *busy;     //--watch: WATCH_BUSY slots, under lock
+    size_t          busy_count;
+};
+
+/* --pipeline: a block travels free -> full (read) -> done (XORed) -> free (written) */
+struct pipe_block {
+    char   *buf;
+    size_t len;                 //0 marks the end of the file
+};
+
+struct pipeline {
+    struct spsc free;           //writer -> reader
+    struct spsc full;           //reader -> XOR stage
+    struct spsc done;           //XOR stage -> writer
+    struct file *src;
+    struct file *tgt;
+    struct key_stream ks;       //only touched by the XOR stage
+    _Atomic int failed;
 };
 
-struct dir {
-    char *path;
-    DIR *id;
-    struct dirent *entry;
-};
+/* --watch: the watched source dirs, by inotify watch descriptor */
+struct watch {
+    int             fd;         //inotify
+    struct dir_node **dirs;     //holds references
+    int             cap;
+    struct dir_node *root;
+    struct pool     *pool;
+    char            *buf;       //WATCH_BUF of events
+    struct {
+        int         wd;
+        const char  *name;      //points into buf
+    }               *seen;      //files already queued from this read
+    size_t          seen_count;
+    int             overflowed; //events were lost - rescan
+};
+
+/* one file in flight in the io_uring engine */
+enum slot_state {
+    SLOT_FREE,
+    SLOT_OPEN_SRC,
+    SLOT_READ,
+    SLOT_OPEN_TGT,
+    SLOT_WRITE,
+    SLOT_CLOSE
+};
+
+struct uring_slot {
+    enum slot_state state;
+    struct dir_node *dir;       //holds a reference
+    char   name[NAME_MAX + 1];  //entry name, relative to the dir fds
+    char   *buf;                //registered buffer (index == slot index)
+    off_t  off;                 //file offset of the data in buf
+    size_t len;                 //bytes of data in buf
+    size_t done;                //bytes of buf already written
+    int    tgt_open;
+    int    pending;             //close completions still expected
+    int    failed;
+    long long start;            //usec, for --latency-log
+    uint32_t crc[2];            //plain/cipher CRC32C (with opts.checksum)
+    struct stat stats;          //source stats (only taken with -i)
+};
+
+/* a worker thread - owns its file contexts (and so its buffers) */
+struct worker {
+    pthread_t   thread;
+    int         id;
+    struct pool *pool;
+    struct deque deque;
+    struct file *src;
+    struct file *tgt;
+    int         rc;
+    unsigned    seed;           //picks the first victim to steal from
+    long long   busy;           //usec spent running tasks
+    size_t      tasks;
+    size_t      stolen;         //tasks taken from other workers
+    size_t      files;          //files encrypted whole
+    size_t      chunks;         //chunks of split files
+};
+
+void encrypt_block(struct file *src, struct file *tgt,
+                   char *dst, const char *in, const char *key, size_t len);
+
+int encrypt_file(struct file *src, struct key *key, struct file *tgt);
+
+int encrypt_file_small(struct file *src, struct key *key, struct file *tgt);
+
+int encrypt_file_mmap(struct file *src, struct key *key, struct file *tgt);
+
+int set_direct(int fd, int on);
+
+int encrypt_file_direct(struct file *src, struct key *key, struct file *tgt);
+
+int open_stream(struct file *src, struct file *tgt,
+                const char *src_path, const char *tgt_path, int out_fd);
+
+int encrypt_stream(struct file *src, struct key *key, struct file *tgt);
+
+int size_target(struct file *tgt, off_t size);
+
+int encrypt_range(struct file *src, struct key *key, struct file *tgt,
+                  off_t off, off_t len, char *buf, uint32_t *crc);
+
+void pipeline_fail(struct pipeline *p);
+
+void* xor_stage(void* void_pipe);
+
+void* write_stage(void* void_pipe);
+
+int encrypt_file_pipelined(struct file *src, struct key *key, struct file *tgt);
+
+int parse_size(const char *str, size_t *size);
+
+int encrypt_dir_uring(struct key *key, struct walker *walker);
+
+int parse_options(int argc, char *argv[]);
+
+int encrypt_entry(struct file *src, struct key *key, struct file *tgt,
+                  struct dir_node *dir, const char *name);
+
+int entry_unchanged(struct dir_node *dir, const char *name, char *rel, struct stat *st);
+
+void entry_emptied(struct dir_node *dir, const char *name, const char *rel);
+
+int deque_init(struct deque *dq);
+
+void deque_destroy(struct deque *dq);
+
+int deque_push(struct deque *dq, struct task *t);
+
+struct task *deque_pop(struct deque *dq);
+
+struct task *deque_steal(struct deque *dq);
+
+struct task *task_create(enum task_type type);
+
+void task_drop(struct task *t);
+
+int task_push(struct pool *pool, struct worker *w, struct task *t);
+
+void task_done(struct pool *pool);
+
+void pool_stop(struct pool *pool);
+
+int pool_wait(struct pool *pool);
+
+struct task *find_task(struct worker *w);
+
+void big_file_free(struct big_file *big);
+
+int split_file(struct worker *w, struct job *job);
+
+int chunk_done(struct big_file *big, size_t n);
+
+int run_task(struct worker *w, struct task *t);
+
+void* worker_thread(void* void_worker);
+
+int pool_flush(struct pool *pool);
+
+int pool_add(struct pool *pool, struct dir_node *dir, const char *name);
+
+uint32_t busy_hash(const char *rel);
+
+struct busy_file *busy_lookup(struct pool *pool, const char *rel, uint32_t hash);
+
+int pool_claim(struct pool *pool, const char *rel);
+
+void pool_release(struct pool *pool, struct dir_node *dir, const char *name);
+
+int pool_start(struct pool *pool, struct key *key);
+
+int pool_finish(struct pool *pool, int rc);
+
+int run_pool(struct key *key, struct walker *walker);
+
+void watch_add(struct watch *w, struct dir_node *dir);
+
+void watch_enter(void *arg, struct dir_node *dir);
+
+int watch_scan(struct watch *w, struct walker *walker);
+
+int watch_rescan(struct watch *w, struct dir_node *dir);
+
+int watch_coalesce(struct watch *w, int wd, const char *name);
+
+int watch_drain(struct watch *w);
+
+int watch_tree(struct key *key, struct dir_node *root, struct walker *walker);
+
+int load_key(struct key *key);
+
+void unload_key(struct key *key);
+
+void key_stream_init(struct key_stream *ks, const struct key *key, off_t offset);
+
+const char *key_stream_next(struct key_stream *ks, size_t len);
+
+int key_stream_thread(void);
+
+int build_key_tile(struct key *key);
+
+int load_seed(struct key *key);
+
+void usage(char* filename);
+
+int create_files(struct file **src,
+                   struct key **key,
+                   struct file **tgt);
+
+struct file *file_create(void);
+
+void file_destroy(struct file *f);
+
+long long now_usec(void);
+
+long long now_nsec(void);
+
+void log_latency(long long start);
+
+long long trace_start(void);
+
+void trace_end(struct file *f, enum phase ph, long long start, uint64_t calls);
+
+void trace_file(struct file *src, const char *rel, long long start);
+
+void destroy_files(struct file **src,
+                   struct key **key,
+                   struct file **tgt);
+
+int open_root(const char *src_path, const char *tgt_path, struct dir_node **root);
+
+int verify_target(const char *tgt_path);
+
+int pack_tree(struct file *src, struct key *key, struct file *tgt,
+              struct walker *walker, const char *archive_path);
+
+int member_name_ok(const char *name);
+
+int extract_member(struct pack_reader *r, struct pack_member *m,
+                   struct key *key, struct file *tgt);
+
+int open_archive(struct pack_reader *r, const char *archive_path);
+
+int unpack_archive(struct key *key, struct file *tgt,
+                   const char *archive_path, const char *tgt_path);
+
+int extract_file(struct key *key, struct file *tgt, const char *archive_path,
+                 const char *name, const char *tgt_path, int out_fd);
+
+int decrypt_range(struct key *key, struct file *tgt, const char *path,
+                  const char *off_str, const char *len_str, int out_fd);
+
+int clear_temp_resources(struct file *src,
+                         struct file *tgt);
+/***/
+
+void usage(char* filename) {
+    printf("Usage: %s [%s] <%s> <%s> <%s>\n"
+           "       %s --verify <target>\n"
+           "       %s --pack [-r] [-b N] <source> <key> <archive>\n"
+           "       %s --unpack <archive> <key> <target>\n"
+           "       %s --extract NAME <archive> <key> <target>\n"
+           "       %s --range FILE <off> <len> <key>\n"
+           "A source or target of - streams a single file through stdin/stdout.\n"
+           "Options:\n"
+           "  --mmap        encrypt through memory mappings instead of read/write\n"
+           "  -j, --jobs N  encrypt with N work-stealing threads (default 1),\n"
+           "                and report how busy each one was\n"
+           "  --chunk-size N       split large files into N-byte chunks (default 8M)\n"
+           "  --chunk-threshold N  split files of at least N bytes across\n"
+           "                       the -j threads (default 64M)\n"
+           "  --uring       keep many files in flight with io_uring\n"
+           "  -r, --recursive  encrypt the whole tree, mirroring subdirectories\n"
+           "  -i, --incremental  only encrypt sources that changed since the last\n"
+           "                     run, and remove targets of deleted sources\n"
+           "  --pipeline    overlap reading, XOR and writing of each file on\n"
+           "                three threads\n"
+           "  --direct      bypass the page cache (O_DIRECT); -b must then be\n"
+           "                a multiple of 4K between 1M and 16M\n"
+           "  --checksum    record CRC32Cs of every source and target in the\n"
+           "                manifest (implied by -i)\n"
+           "  --verify      check the targets against the recorded CRC32Cs\n"
+           "  --chacha      generate the key bytes with ChaCha20, seeded by the key\n"
+           "                file (32-byte key, optionally followed by an 8-byte nonce)\n"
+           "  -b, --bufsize N  bytes per read/XOR/write block\n"
+           "                   (default 64K, 1M when streaming or with --direct)\n"
+           "  --latency-log FILE  write each file's encryption time (usec) to FILE\n"
+           "  --pack        encrypt the files into one archive, indexed at its end\n"
+           "  --unpack      decrypt every file of an archive into the target dir\n"
+           "  --extract NAME  decrypt just NAME (as packed, e.g. sub/file) into the\n"
+           "                  target file, or - for stdout\n"
+           "  --range FILE  decrypt just len bytes at off of FILE to stdout\n"
+           "  --watch       keep running, and encrypt files (on the -j threads) as\n"
+           "                they are written to the source; implies -i\n"
+           "  --stats json  write each file's open/read/xor/write/close times and\n"
+           "                syscall counts to stderr, and histograms at the end\n"
+           "Aborting...\n",
+            filename,
+            "options",
+            "source",
+            "key",
+            "target",
+            filename,
+            filename,
+            filename,
+            filename,
+            filename);
+}
+
+/* parses a byte count with an optional K/M/G suffix */
+int parse_size(const char *str, size_t *size) {
+    char *end;
+    unsigned long long val;
+    int shift = 0;
+
+    errno = 0;
+    val = strtoull(str, &end, 10);
+    if (errno || end == str || *str == '-')
+        return 1;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end || val > (SIZE_MAX >> shift))
+        return 1;
+    val <<= shift;
+    *size = (size_t)val;
+    return 0;
+}
+
+int parse_options(int argc, char *argv[]) {
+    static const struct option long_opts[] = {
+        { "mmap", no_argument,       NULL, 'm' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "chunk-size",      required_argument, NULL, 'c' },
+        { "chunk-threshold", required_argument, NULL, 't' },
+        { "uring", no_argument,      NULL, 'u' },
+        { "recursive", no_argument,  NULL, 'r' },
+        { "incremental", no_argument, NULL, 'i' },
+        { "bufsize", required_argument, NULL, 'b' },
+        { "latency-log", required_argument, NULL, 'L' },
+        { "pipeline", no_argument,   NULL, 'p' },
+        { "direct", no_argument,     NULL, 'd' },
+        { "chacha", no_argument,     NULL, 'C' },
+        { "checksum", no_argument,   NULL, 'K' },
+        { "verify", no_argument,     NULL, 'V' },
+        { "pack", no_argument,       NULL, 'P' },
+        { "unpack", no_argument,     NULL, 'U' },
+        { "extract", required_argument, NULL, 'X' },
+        { "range", required_argument, NULL, 'R' },
+        { "watch", no_argument,      NULL, 'W' },
+        { "stats", required_argument, NULL, 'S' },
+        { NULL,   0,                 NULL, 0 }
+    };
+    char *end;
+    long jobs;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "j:rib:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'm':
+            opts.use_mmap = 1;
+            break;
+        case 'j':
+            errno = 0;
+            jobs = strtol(optarg, &end, 10);
+            if (errno || end == optarg || *end || jobs < 1 || jobs > MAX_JOBS) {
+                printf("ERROR: Invalid number of jobs [%s]\n", optarg);
+                return 1;
+            }
+            opts.jobs = (int)jobs;
+            break;
+        case 'c':
+            if (parse_size(optarg, &opts.chunk_size) || !opts.chunk_size) {
+                printf("ERROR: Invalid chunk size [%s]\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            if (parse_size(optarg, &opts.chunk_min)) {
+                printf("ERROR: Invalid chunk threshold [%s]\n", optarg);
+                return 1;
+            }
+            break;
+        case 'u':
+            opts.use_uring = 1;
+            break;
+        case 'r':
+            opts.recursive = 1;
+            break;
+        case 'i':
+            opts.incremental = 1;
+            break;
+        case 'b':
+            if (parse_size(optarg, &opts.buf_size) ||
+                opts.buf_size < MIN_BUF_SIZE || opts.buf_size > MAX_BUF_SIZE) {
+                printf("ERROR: Invalid buffer size [%s]\n", optarg);
+                return 1;
+            }
+            break;
+        case 'L':
+            opts.latency_log = optarg;
+            break;
+        case 'p':
+            opts.pipeline = 1;
+            break;
+        case 'd':
+            opts.direct = 1;
+            break;
+        case 'C':
+            opts.chacha = 1;
+            break;
+        case 'K':
+            opts.checksum = 1;
+            break;
+        case 'V':
+            opts.verify = 1;
+            break;
+        case 'P':
+            opts.pack = 1;
+            break;
+        case 'U':
+            opts.unpack = 1;
+            break;
+        case 'X':
+            opts.extract = optarg;
+            break;
+        case 'R':
+            opts.range = optarg;
+            break;
+        case 'W':
+            opts.watch = 1;
+            break;
+        case 'S':
+            if (strcmp(optarg, "json")) {
+                printf("ERROR: Invalid stats format [%s] (only json)\n", optarg);
+                return 1;
+            }
+            opts.stats = 1;
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    //the ring is its own scheduler
+    if (opts.use_uring && (opts.use_mmap || opts.jobs > 1)) {
+        printf("ERROR: --uring can't be combined with --mmap or -j\n");
+        return 1;
+    }
+    if (opts.pipeline && (opts.use_mmap || opts.use_uring)) {
+        printf("ERROR: --pipeline can't be combined with --mmap or --uring\n");
+        return 1;
+    }
+
+    //an archive is written (and unpacked) front to back by one thread
+    if (opts.pack + opts.unpack + !!opts.extract > 1 ||
+        ((opts.pack || opts.unpack || opts.extract) &&
+         (opts.use_mmap || opts.jobs > 1 || opts.use_uring || opts.pipeline ||
+          opts.direct || opts.incremental || opts.checksum || opts.verify))) {
+        printf("ERROR: --pack, --unpack and --extract can't be combined with each other,\n"
+               "--mmap, -j, --uring, --pipeline, --direct, -i, --checksum or --verify\n");
+        return 1;
+    }
+    //a range is a few preads of one file
+    if (opts.range && (opts.use_mmap || opts.jobs > 1 || opts.use_uring || opts.pipeline ||
+                       opts.direct || opts.recursive || opts.incremental || opts.checksum ||
+                       opts.verify || opts.pack || opts.unpack || opts.extract)) {
+        printf("ERROR: --range can only be combined with --chacha and -b\n");
+        return 1;
+    }
+    //a daemon over a directory tree
+    if (opts.watch && (opts.use_uring || opts.verify || opts.pack || opts.unpack ||
+                       opts.extract || opts.range)) {
+        printf("ERROR: --watch can't be combined with --uring, --verify, --pack,\n"
+               "--unpack, --extract or --range\n");
+        return 1;
+    }
+    //only the per-file engines are traced
+    if (opts.stats && (opts.use_uring || opts.verify || opts.pack || opts.unpack ||
+                       opts.extract || opts.range)) {
+        printf("ERROR: --stats can't be combined with --uring, --verify, --pack,\n"
+               "--unpack, --extract or --range\n");
+        return 1;
+    }
+    //the manifest tells the rescans which files are already done
+    if (opts.watch)
+        opts.incremental = 1;
+
+    //the index carries the CRC32C of every payload
+    if (opts.pack)
+        opts.checksum = 1;
+
+    //a stream is a single file, read front to back
+    if (argc - optind == 3 && !opts.pack && !opts.unpack && !opts.extract && !opts.range)
+        opts.streaming = !strcmp(argv[optind], "-") || !strcmp(argv[optind + 2], "-");
+    if (opts.streaming && (opts.use_mmap || opts.jobs > 1 || opts.use_uring ||
+                           opts.recursive || opts.incremental || opts.checksum || opts.stats)) {
+        printf("ERROR: - can't be combined with --mmap, -j, --uring, -r, -i, --checksum\n"
+               "or --stats\n");
+        return 1;
+    }
+
+    //the manifest -i keeps always carries the checksums
+    if (opts.incremental)
+        opts.checksum = 1;
+    if (opts.direct && (opts.use_mmap || opts.use_uring || opts.pipeline || opts.streaming)) {
+        printf("ERROR: --direct can't be combined with --mmap, --uring, --pipeline or -\n");
+        return 1;
+    }
+
+    if (!opts.buf_size)
+        opts.buf_size = opts.streaming ? STREAM_BUF_SIZE :
+                        opts.direct ? DIRECT_BUF_SIZE : DEF_BUF_SIZE;
+    if (opts.direct && (opts.buf_size < DIRECT_BUF_SIZE || opts.buf_size > DIRECT_BUF_MAX ||
+                        opts.buf_size % DIRECT_ALIGN)) {
+        printf("ERROR: --direct needs a buffer size of 1M-16M in 4K steps\n");
+        return 1;
+    }
+    return 0;
+}
+
+int create_files(struct file **src,
+                   struct key **key,
+                   struct file  **tgt) {
+
+    *src = file_create();
+    *key = (struct key *) malloc (sizeof(struct key));
+    *tgt = file_create();
+
+    if ( !(*src) || !(*tgt) || !(*key) ) {
+        return 1;
+    }
+
+    memset(*key, 0, sizeof(struct key));
+
+    return 0;
+}
+
+void destroy_files(struct file **src,
+                   struct key **key,
+                   struct file **tgt) {
+
+    file_destroy(*src);
+    free(*key);
+    file_destroy(*tgt);
+
+}
+
+struct file *file_create(void) {
+    struct file *f = (struct file *) calloc (1, sizeof(struct file));
+
+    if (!f)
+        return NULL;
+    //page aligned, as --direct requires
+    if (posix_memalign((void **)&f->buf, DIRECT_ALIGN, opts.buf_size)) {
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+void file_destroy(struct file *f) {
+    if (!f)
+        return;
+    free(f->buf);
+    free(f);
+}
+
+long long now_usec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+long long now_nsec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void log_latency(long long start) {
+    if (latency_log)
+        fprintf(latency_log, "%lld\n", now_usec() - start);
+}
+
+/* --stats: a phase is timed from trace_start() to trace_end(). without
+ * --stats neither reads the clock */
+long long trace_start(void) {
+    return opts.stats ? now_nsec() : 0;
+}
+
+void trace_end(struct file *f, enum phase ph, long long start, uint64_t calls) {
+    if (!opts.stats)
+        return;
+    __atomic_add_fetch(&f->trace.ns[ph], (uint64_t)(now_nsec() - start), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&f->trace.calls[ph], calls, __ATOMIC_RELAXED);
+}
+
+/* records a finished file, encrypted since start (a trace_start() time) */
+void trace_file(struct file *src, const char *rel, long long start) {
+    if (opts.stats)
+        stats_file(run_stats, rel, (uint64_t)src->stats.st_size,
+                   (uint64_t)(now_nsec() - start), &src->trace);
+}
+
+int clear_temp_resources(struct file *src,
+                         struct file *tgt) {
+
+    int _rc = 0;
+    if (src->id >= 0)
+        _rc |= close(src->id);
+    if (tgt->id >= 0)
+        _rc |= close(tgt->id);
+    return _rc;
+}
+
+int load_key(struct key *key) {
+    ssize_t b_read;
+    size_t total = 0;
+
+    if (opts.chacha)
+        return load_seed(key);
+
+    key->size = (size_t)key->stats.st_size;
+
+    //map the whole key once, so no syscalls are needed per key byte
+    key->data = mmap(NULL, key->size, PROT_READ, MAP_PRIVATE, key->id, 0);
+    if (key->data != MAP_FAILED) {
+        key->mapped = 1;
+        return build_key_tile(key);
+    }
+
+    //file can't be mapped - read it into memory instead
+    key->mapped = 0;
+    key->data = (char *) malloc (key->size);
+    if (!key->data) {
+        printf("ERROR: Failed to allocate key buffer for file [%s]\n",
+               key->path);
+        return EXIT_FAILURE;
+    }
+    while (total < key->size) {
+        b_read = read(key->id, key->data + total, key->size - total);
+        if (b_read <= 0) {
+            printf("ERROR: Failed to read from file [%s]\n"
+                   "Cause: %s [%d]\n",
+                   key->path, strerror(errno), errno);
+            free(key->data);
+            key->data = NULL;
+            return EXIT_FAILURE;
+        }
+        total += (size_t)b_read;
+    }
+    return build_key_tile(key);
+}
+
+/* lays the key out repeatedly in one cache-line aligned buffer, built once
+ * per run and shared by every file and thread. a slice of up to
+ * opts.buf_size bytes starting anywhere in the key is then contiguous, so
+ * the XOR never wraps mid-block */
+int build_key_tile(struct key *key) {
+    size_t n, m;
+
+    key->tile_size = ((key->size + opts.buf_size - 1) / opts.buf_size + 1) * opts.buf_size;
+    if (posix_memalign((void **)&key->tile, CACHE_LINE, key->tile_size)) {
+        key->tile = NULL;
+        printf("ERROR: Failed to allocate key tile for file [%s]\n",
+               key->path);
+        return EXIT_FAILURE;
+    }
+
+    //copy the key once, then keep doubling the repeated part
+    memcpy(key->tile, key->data, key->size);
+    for (n = key->size; n < key->tile_size; n += m) {
+        m = MIN(n, key->tile_size - n);
+        memcpy(key->tile + n, key->tile, m);
+    }
+
+    //the tile is all that's needed from here on
+    if (key->mapped)
+        munmap(key->data, key->size);
+    else
+        free(key->data);
+    key->data = NULL;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * --chacha: the key file only holds the seed. key bytes are generated on
+ * demand from the block counter (file offset / 64), so neither the key size
+ * nor the offset costs anything, and chunks can still start anywhere.
+ */
+int load_seed(struct key *key) {
+    uint8_t seed[CHACHA_KEY_SIZE + CHACHA_NONCE_SIZE];
+    size_t size = (size_t)key->stats.st_size;
+    ssize_t b_read;
+    size_t total = 0;
+
+    if (size != CHACHA_KEY_SIZE && size != sizeof(seed)) {
+        printf("ERROR: A ChaCha20 seed is %d or %zu bytes [%s]\n",
+               CHACHA_KEY_SIZE, sizeof(seed), key->path);
+        return EXIT_FAILURE;
+    }
+    while (total < size) {
+        b_read = read(key->id, seed + total, size - total);
+        if (b_read <= 0) {
+            printf("ERROR: Failed to read from file [%s]\n"
+                   "Cause: %s [%d]\n",
+                   key->path, strerror(errno), errno);
+            return EXIT_FAILURE;
+        }
+        total += (size_t)b_read;
+    }
+    chacha_setup(&key->chacha, seed, size > CHACHA_KEY_SIZE ? seed + CHACHA_KEY_SIZE : NULL);
+    memset(seed, 0, sizeof(seed));
+    chacha_init();
+
+    //scratch buffers of exiting worker threads are freed with them
+    if (pthread_key_create(&chacha_scratch, free)) {
+        printf("ERROR: Failed to create keystream buffers\n");
+        return EXIT_FAILURE;
+    }
+    key->seeded = 1;
+    return key_stream_thread() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void unload_key(struct key *key) {
+    if (key->seeded) {
+        free(pthread_getspecific(chacha_scratch));
+        pthread_key_delete(chacha_scratch);
+        key->seeded = 0;
+    }
+    free(key->tile);
+    key->tile = NULL;
+    if (!key->data)
+        return;
+    if (key->mapped)
+        munmap(key->data, key->size);
+    else
+        free(key->data);
+    key->data = NULL;
+}
+
+void key_stream_init(struct key_stream *ks, const struct key *key, off_t offset) {
+    ks->key = key;
+    ks->off = opts.chacha ? (size_t)offset : (size_t)offset % key->size;
+}
+
+/* --chacha: gives the calling thread the buffer its keystream is generated
+ * into. every thread calls it before its first key_stream_next().
+ * returns 1 if out of memory */
+int key_stream_thread(void) {
+    char *scratch;
+
+    if (!opts.chacha || pthread_getspecific(chacha_scratch))
+        return 0;
+    //one block of slack on each side of an unaligned slice
+    if (posix_memalign((void **)&scratch, CACHE_LINE, opts.buf_size + 2 * CHACHA_BLOCK)) {
+        printf("ERROR: Failed to allocate keystream buffer\n");
+        return 1;
+    }
+    if (pthread_setspecific(chacha_scratch, scratch)) {
+        printf("ERROR: Failed to set keystream buffer\n");
+        free(scratch);
+        return 1;
+    }
+    return 0;
+}
+
+/* returns the next len (<= opts.buf_size) key bytes, in place in the tile */
+const char *key_stream_next(struct key_stream *ks, size_t len) {
+    const char *slice;
+    char *scratch;
+    size_t skip;
+
+    if (opts.chacha) {
+        scratch = pthread_getspecific(chacha_scratch);
+        skip = ks->off % CHACHA_BLOCK;
+        chacha_blocks(&ks->key->chacha, ks->off / CHACHA_BLOCK,
+                      (skip + len + CHACHA_BLOCK - 1) / CHACHA_BLOCK, (uint8_t *)scratch);
+        ks->off += len;
+        return scratch + skip;
+    }
+
+    slice = ks->key->tile + ks->off;
+    ks->off = (ks->off + len) % ks->key->size;
+    return slice;
+}
+
+/* XORs one block. with checksums on, the same pass over the data folds the
+ * plaintext into src->crc and the ciphertext into tgt->crc */
+void encrypt_block(struct file *src, struct file *tgt,
+                   char *dst, const char *in, const char *key, size_t len) {
+    if (opts.checksum)
+        xor_crc32c(dst, in, key, len, &src->crc, &tgt->crc);
+    else
+        xor_buf(dst, in, key, len);
+}
+
+int encrypt_file(struct file *src, struct key *key, struct file *tgt) {
+
+    ssize_t bytes_read, bytes_needed, bytes_written;
+    bytes_needed = (ssize_t)opts.buf_size;
+    struct key_stream ks;
+    long long t = trace_start();
+
+    //every file is encrypted from the start of the key
+    key_stream_init(&ks, key, 0);
+
+    while((bytes_read = read(src->id, src->buf,(size_t)bytes_needed)) > 0) {
+        trace_end(src, PH_READ, t, 1);
+
+        //encrypt bytes into tgt buffer, against the next key slice
+        t = trace_start();
+        encrypt_block(src, tgt, tgt->buf, src->buf,
+                      key_stream_next(&ks, (size_t)bytes_read), (size_t)bytes_read);
+        trace_end(src, PH_XOR, t, 1);
+
+        //write buffer into file
+        t = trace_start();
+        bytes_written = write(tgt->id, tgt->buf, (size_t)bytes_read);
+        if (bytes_written < bytes_read) {
+            PR_FILE_ERR("Failed to write to file", tgt);
+            return EXIT_FAILURE;
+        }
+        trace_end(src, PH_WRITE, t, 1);
+        t = trace_start();
+    }
+    trace_end(src, PH_READ, t, 1);
+
+    if (bytes_read < 0) { //ended with read error
+        PR_FILE_ERR("Failed to read from file", src);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* a file that fits in one buffer: one read (unless it comes back short),
+ * one write, and no read just to find the end of it */
+int encrypt_file_small(struct file *src, struct key *key, struct file *tgt) {
+
+    size_t size = (size_t)src->stats.st_size;
+    ssize_t bytes_read = 0, bytes_written, n;
+    struct key_stream ks;
+    long long t = trace_start();
+    int calls = 0;
+
+    //read() may return less than asked - stop at the size or the end of the file
+    while ((size_t)bytes_read < size) {
+        n = read(src->id, src->buf + bytes_read, size - (size_t)bytes_read);
+        calls++;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            PR_FILE_ERR("Failed to read from file", src);
+            return EXIT_FAILURE;
+        }
+        if (!n)
+            break;
+        bytes_read += n;
+    }
+    trace_end(src, PH_READ, t, calls);
+    //a file that shrank since fstat is encrypted as read - one that grew, up to its size then
+    if (!bytes_read)
+        return EXIT_SUCCESS;
+
+    t = trace_start();
+    key_stream_init(&ks, key, 0);
+    encrypt_block(src, tgt, tgt->buf, src->buf,
+                  key_stream_next(&ks, (size_t)bytes_read), (size_t)bytes_read);
+    trace_end(src, PH_XOR, t, 1);
+
+    t = trace_start();
+    bytes_written = write(tgt->id, tgt->buf, (size_t)bytes_read);
+    if (bytes_written < bytes_read) {
+        PR_FILE_ERR("Failed to write to file", tgt);
+        return EXIT_FAILURE;
+    }
+    trace_end(src, PH_WRITE, t, 1);
+    return EXIT_SUCCESS;
+}
+
+int size_target(struct file *tgt, off_t size) {
+
+    //reserve the blocks up front where the filesystem supports it
+    if (!fallocate(tgt->id, 0, 0, size))
+        return EXIT_SUCCESS;
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        PR_FILE_ERR("Failed to allocate file", tgt);
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(tgt->id, size)) {
+        PR_FILE_ERR("Failed to resize file", tgt);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int encrypt_file_mmap(struct file *src, struct key *key, struct file *tgt) {
+
+    off_t size = src->stats.st_size;
+    off_t off;
+    size_t win, i, n;
+    char *src_map, *tgt_map;
+    struct key_stream ks;
+    long long t;
+
+    //pipes, devices etc. can't be mapped
+    if (!S_ISREG(src->stats.st_mode))
+        return encrypt_file(src, key, tgt);
+
+    if (size_target(tgt, size))
+        return EXIT_FAILURE;
+
+    key_stream_init(&ks, key, 0);
+
+    //map a window of both files at a time, so huge files fit the address space
+    for (off = 0; off < size; off += (off_t)win) {
+        win = (size_t)MIN((off_t)MMAP_WINDOW, size - off);
+
+        src_map = mmap(NULL, win, PROT_READ, MAP_SHARED, src->id, off);
+        if (src_map == MAP_FAILED) {
+            PR_FILE_ERR("Failed to mmap file", src);
+            return EXIT_FAILURE;
+        }
+        tgt_map = mmap(NULL, win, PROT_READ | PROT_WRITE, MAP_SHARED, tgt->id, off);
+        if (tgt_map == MAP_FAILED) {
+            PR_FILE_ERR("Failed to mmap file", tgt);
+            munmap(src_map, win);
+            return EXIT_FAILURE;
+        }
+        madvise(src_map, win, MADV_SEQUENTIAL);
+        madvise(tgt_map, win, MADV_SEQUENTIAL);
+
+        //page faults do the reading and writing here - they count as xor
+        t = trace_start();
+        for (i = 0; i < win; i += n) {
+            n = MIN(win - i, opts.buf_size);
+            encrypt_block(src, tgt, tgt_map + i, src_map + i, key_stream_next(&ks, n), n);
+        }
+        trace_end(src, PH_XOR, t, (win + opts.buf_size - 1) / opts.buf_size);
+
+        munmap(src_map, win);
+        if (munmap(tgt_map, win)) {
+            PR_FILE_ERR("Failed to unmap file", tgt);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/* toggles O_DIRECT on an open file. fails (EINVAL) where the fs lacks it */
+int set_direct(int fd, int on) {
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, on ? flags | O_DIRECT : flags & ~O_DIRECT);
+}
+
+/*
+ * --direct: moves the file through our own page-aligned buffers, so a bulk
+ * run doesn't evict everybody else's page cache. O_DIRECT needs aligned
+ * lengths, so the last partial page goes through the cache, and is dropped
+ * from it right after. the target is preallocated to its final size first.
+ */
+int encrypt_file_direct(struct file *src, struct key *key, struct file *tgt) {
+    static _Atomic int warned;
+    off_t size = src->stats.st_size;
+    off_t aligned = size & ~((off_t)DIRECT_ALIGN - 1);
+    off_t off = 0;
+    struct key_stream ks;
+    long long t;
+    ssize_t n;
+    size_t len;
+
+    if (!S_ISREG(src->stats.st_mode))
+        return encrypt_file(src, key, tgt);
+    if (set_direct(src->id, 1) || set_direct(tgt->id, 1)) {
+        if (!atomic_exchange(&warned, 1))
+            printf("WARNING: O_DIRECT is unsupported for [%s/%s]\n"
+                   "Falling back to buffered I/O...\n",
+                   src->dir_path, src->name);
+        set_direct(src->id, 0);
+        return encrypt_file(src, key, tgt);
+    }
+    if (size_target(tgt, size))
+        return EXIT_FAILURE;
+
+    key_stream_init(&ks, key, 0);
+    while (off < size) {
+        //past the aligned part, the tail goes through the page cache
+        if (off == aligned && (set_direct(src->id, 0) || set_direct(tgt->id, 0))) {
+            PR_FILE_ERR("Failed to leave direct mode", src);
+            return EXIT_FAILURE;
+        }
+        len = (size_t)MIN((off_t)opts.buf_size, (off < aligned ? aligned : size) - off);
+        t = trace_start();
+        n = pread(src->id, src->buf, len, off);
+        if (n < 0) {
+            PR_FILE_ERR("Failed to read from file", src);
+            return EXIT_FAILURE;
+        }
+        trace_end(src, PH_READ, t, 1);
+        if (!n)
+            break;      //the source shrank under us
+
+        t = trace_start();
+        encrypt_block(src, tgt, tgt->buf, src->buf, key_stream_next(&ks, (size_t)n), (size_t)n);
+        trace_end(src, PH_XOR, t, 1);
+
+        //a short direct read is only possible at end of file, where the
+        //length no longer has to be aligned
+        t = trace_start();
+        if (pwrite(tgt->id, tgt->buf, (size_t)n, off) != n) {
+            PR_FILE_ERR("Failed to write to file", tgt);
+            return EXIT_FAILURE;
+        }
+        trace_end(src, PH_WRITE, t, 1);
+        off += n;
+    }
+
+    if (aligned < size) {
+        posix_fadvise(src->id, aligned, 0, POSIX_FADV_DONTNEED);
+        posix_fadvise(tgt->id, aligned, 0, POSIX_FADV_DONTNEED);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * '-': opens the two ends of a stream. either end may still be a plain file,
+ * so `cipher - key out` and `cipher in key -` work too. pipes are enlarged
+ * so each side moves a whole block per wakeup (best effort - the limit is
+ * /proc/sys/fs/pipe-max-size).
+ */
+int open_stream(struct file *src, struct file *tgt,
+                const char *src_path, const char *tgt_path, int out_fd) {
+    struct stat st;
+
+    src->id = tgt->id = -1;
+    src->dir_path = tgt->dir_path = ".";
+    src->name = strcmp(src_path, "-") ? src_path : "stdin";
+    tgt->name = strcmp(tgt_path, "-") ? tgt_path : "stdout";
+    src->id = strcmp(src_path, "-") ? open(src_path, O_RDONLY) : STDIN_FILENO;
+    if (src->id < 0) {
+        printf("ERROR: Failed to open source file [%s]\n"
+               "Cause: %s [%d]\n",
+               src_path, strerror(errno), errno);
+        return 1;
+    }
+    if (!fstat(src->id, &st) && S_ISDIR(st.st_mode)) {
+        printf("ERROR: Can't stream a directory [%s]\n", src_path);
+        return 1;
+    }
+    tgt->id = strcmp(tgt_path, "-") ? open(tgt_path, O_WRONLY | O_CREAT | O_TRUNC, RW)
+                                    : out_fd;
+    if (tgt->id < 0) {
+        printf("ERROR: Failed to open target file [%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, strerror(errno), errno);
+        return 1;
+    }
+
+    if (!fstat(src->id, &st) && S_ISFIFO(st.st_mode))
+        fcntl(src->id, F_SETPIPE_SZ, PIPE_SIZE);
+    if (!fstat(tgt->id, &st) && S_ISFIFO(st.st_mode))
+        fcntl(tgt->id, F_SETPIPE_SZ, PIPE_SIZE);
+    return 0;
+}
+
+/*
+ * '-': pipes hand out whatever is buffered, so every block is filled before
+ * it is encrypted. the output then goes out in large contiguous writes, and
+ * the key stream only ever advances by whole blocks until the final one.
+ */
+int encrypt_stream(struct file *src, struct key *key, struct file *tgt) {
+    struct key_stream ks;
+    size_t fill, done;
+    ssize_t n;
+
+    key_stream_init(&ks, key, 0);
+    do {
+        for (fill = 0; fill < opts.buf_size; fill += (size_t)n) {
+            n = read(src->id, src->buf + fill, opts.buf_size - fill);
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            if (n < 0) {
+                printf("ERROR: Failed to read from file [%s]\n"
+                       "Cause: %s [%d]\n",
+                       src->name, strerror(errno), errno);
+                return EXIT_FAILURE;
+            }
+            if (!n)
+                break;          //end of stream
+        }
+
+        xor_buf(tgt->buf, src->buf, key_stream_next(&ks, fill), fill);
+
+        //stdout may be a socket, where short writes are legal
+        for (done = 0; done < fill; done += (size_t)n) {
+            n = write(tgt->id, tgt->buf + done, fill - done);
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            if (n <= 0) {
+                printf("ERROR: Failed to write to file [%s]\n"
+                       "Cause: %s [%d]\n",
+                       tgt->name, strerror(errno), errno);
+                return EXIT_FAILURE;
+            }
+        }
+    } while (fill == opts.buf_size);
+
+    return EXIT_SUCCESS;
+}
+
+/* encrypts one directory entry.
+ * returns 0 on success, 1 if the file was skipped and -1 on a fatal error */
+int encrypt_entry(struct file *src, struct key *key, struct file *tgt,
+                  struct dir_node *dir, const char *name) {
+
+    char rel[PATH_MAX];
+    struct stat st;
+    long long start = latency_log ? now_usec() : 0;
+    long long t0 = trace_start(), t;
+    int rc;
+
+    if (opts.incremental && entry_unchanged(dir, name, rel, &st))
+        return 0;
+    if ((manifest || opts.stats) && !opts.incremental)
+        snprintf(rel, PATH_MAX, "%s%s%s", dir->rel_path, dir->rel_path[0] ? "/" : "", name);
+
+    //files are named by their dir fd and entry name - no paths are built
+    src->dir_path = dir->src_path;
+    tgt->dir_path = dir->tgt_path;
+    src->name = tgt->name = name;
+    src->id = -1;
+    tgt->id = -1;
+    src->crc = tgt->crc = 0;
+    if (opts.stats)
+        memset(&src->trace, 0, sizeof(src->trace));
+
+    //open source file
+    t = trace_start();
+    src->id = openat(dir->src_fd, name, O_RDONLY);
+    if (src->id < 0) {
+        PR_FILE_ERR("Failed to open source file", src);
+        clear_temp_resources(src, tgt);
+        return 1;
+    }
+    if(fstat(src->id, &src->stats) || !src->stats.st_size ||
+       S_ISDIR(src->stats.st_mode)) {
+        printf("WARNING: File stats are bad for file [%s/%s]\n"
+               "Skipping file...\n"
+               "Cause: %s [%d]\n",
+               src->dir_path, name, strerror(errno), errno);
+        if (manifest && S_ISREG(src->stats.st_mode) && !src->stats.st_size)
+            entry_emptied(dir, name, rel);
+        clear_temp_resources(src, tgt);
+        return 1;
+    }
+
+    //open target file (mapping it needs read access too)
+    tgt->id = openat(dir->tgt_fd, name,
+                     (opts.use_mmap ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, RW);
+    if (tgt->id < 0) {
+        PR_FILE_ERR("Failed to open target file", tgt);
+        clear_temp_resources(src, tgt);
+        return -1;
+    }
+    trace_end(src, PH_OPEN, t, 3);
+
+    //encrypt file
+    if (opts.use_mmap)
+        rc = encrypt_file_mmap(src, key, tgt);
+    else if (opts.direct)
+        rc = encrypt_file_direct(src, key, tgt);
+    else if ((size_t)src->stats.st_size <= opts.buf_size)
+        rc = encrypt_file_small(src, key, tgt);
+    else if (opts.pipeline &&
+             (size_t)src->stats.st_size >= PIPE_MIN_BLOCKS * opts.buf_size)
+        rc = encrypt_file_pipelined(src, key, tgt);
+    else
+        rc = encrypt_file(src, key, tgt);
+    if (rc) {
+        PR_FILE_ERR("Failed to encrypt file", src);
+        clear_temp_resources(src, tgt);
+        if (manifest)
+            manifest_drop(manifest, rel);
+        return -1;
+    }
+
+    //reset conditions
+    t = trace_start();
+    if (clear_temp_resources(src, tgt)) {
+        printf("ERROR: Failed to clean resources for files\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        return -1;
+    }
+    trace_end(src, PH_CLOSE, t, 2);
+    if (manifest && manifest_update(manifest, rel, &src->stats, src->crc, tgt->crc))
+        return -1;
+    log_latency(start);
+    trace_file(src, rel, t0);
+    return 0;
+}
+
+/* -i: returns 1 if a source hasn't changed since it was encrypted (and its
+ * target is still there). fills rel with the path relative to the roots,
+ * and st with the source stats */
+int entry_unchanged(struct dir_node *dir, const char *name, char *rel, struct stat *st) {
+    struct stat tgt_st;
+
+    snprintf(rel, PATH_MAX, "%s%s%s", dir->rel_path, dir->rel_path[0] ? "/" : "", name);
+    if (fstatat(dir->src_fd, name, st, 0))
+        return 0;       //let the regular path report it
+    return manifest_unchanged(manifest, rel, st) &&
+           !fstatat(dir->tgt_fd, name, &tgt_st, 0) && tgt_st.st_size == st->st_size;
+}
+
+/* a source that is empty now gets no target - drops the one (and the
+ * manifest entry) of an earlier run, so neither outlives it */
+void entry_emptied(struct dir_node *dir, const char *name, const char *rel) {
+    if (unlinkat(dir->tgt_fd, name, 0) && errno != ENOENT)
+        printf("WARNING: Failed to remove stale target [%s/%s]\n"
+               "Cause: %s [%d]\n",
+               dir->tgt_path, name, strerror(errno), errno);
+    manifest_drop(manifest, rel);
+}
+
+int deque_init(struct deque *dq) {
+    memset(dq, 0, sizeof(struct deque));
+    dq->cap = 64;
+    dq->tasks = (struct task **) malloc (dq->cap * sizeof(struct task *));
+    if (!dq->tasks)
+        return 1;
+    if (pthread_mutex_init(&dq->lock, NULL)) {
+        free(dq->tasks);
+        return 1;
+    }
+    return 0;
+}
+
+void deque_destroy(struct deque *dq) {
+    pthread_mutex_destroy(&dq->lock);
+    free(dq->tasks);
+}
+
+/* grows the ring when full. returns 1 if that fails */
+int deque_push(struct deque *dq, struct task *t) {
+    struct task **tasks;
+    size_t i;
+    int rc = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    /**CS**/
+    if (dq->count == dq->cap) {
+        tasks = (struct task **) malloc (2 * dq->cap * sizeof(struct task *));
+        if (tasks) {
+            for (i = 0; i < dq->count; i++)
+                tasks[i] = dq->tasks[(dq->top + i) % dq->cap];
+            free(dq->tasks);
+            dq->tasks = tasks;
+            dq->top = 0;
+            dq->cap *= 2;
+        }
+    }
+    if (dq->count < dq->cap)
+        dq->tasks[(dq->top + dq->count++) % dq->cap] = t;
+    else
+        rc = 1;
+    /**CS-END**/
+    pthread_mutex_unlock(&dq->lock);
+    return rc;
+}
+
+/* owner's end - the newest task */
+struct task *deque_pop(struct deque *dq) {
+    struct task *t = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    /**CS**/
+    if (dq->count > 0)
+        t = dq->tasks[(dq->top + --dq->count) % dq->cap];
+    /**CS-END**/
+    pthread_mutex_unlock(&dq->lock);
+    return t;
+}
+
+/* thieves' end - the oldest task */
+struct task *deque_steal(struct deque *dq) {
+    struct task *t = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    /**CS**/
+    if (dq->count > 0) {
+        t = dq->tasks[dq->top];
+        dq->top = (dq->top + 1) % dq->cap;
+        dq->count--;
+    }
+    /**CS-END**/
+    pthread_mutex_unlock(&dq->lock);
+    return t;
+}
+
+struct task *task_create(enum task_type type) {
+    struct task *t;
+    size_t size = sizeof(struct task);
+
+    if (type == TASK_FILES)
+        size += BATCH_FILES * sizeof(struct job);
+    t = (struct task *) malloc (size);
+    if (!t)
+        return NULL;
+    t->type = type;
+    t->big = NULL;
+    t->index = 0;
+    t->count = 0;
+    return t;
+}
+
+/* releases a task that won't run (the run was stopped) */
+void task_drop(struct task *t) {
+    int i;
+
+    if (t->type == TASK_CHUNK) {
+        __atomic_store_n(&t->big->rc, 1, __ATOMIC_RELAXED);
+        chunk_done(t->big, 1);
+    }
+    for (i = 0; i < t->count; i++)
+        dir_put(t->jobs[i].dir);
+    free(t);
+}
+
+/* queues t at the bottom of w's deque. returns 1 if it couldn't be queued */
+int task_push(struct pool *pool, struct worker *w, struct task *t) {
+    int rc;
+
+    //queued is raised before anyone can pop the task (and lower it again)
+    pthread_mutex_lock(&pool->lock);
+    /**CS**/
+    rc = deque_push(&w->deque, t);
+    if (!rc) {
+        pool->queued++;
+        pool->pending++;
+    }
+    /**CS-END**/
+    pthread_mutex_unlock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    return rc;
+}
+
+void task_done(struct pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    /**CS**/
+    pool->pending--;
+    if (!pool->pending && pool->closed)
+        pthread_cond_broadcast(&pool->work);
+    if (pool->pending < MAX_TASKS)
+        pthread_cond_signal(&pool->room);
+    /**CS-END**/
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_stop(struct pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_cond_broadcast(&pool->work);
+    pthread_cond_broadcast(&pool->room);
+}
+
+/* sleeps until some deque has a task. returns 1 once the run is over */
+int pool_wait(struct pool *pool) {
+    int over;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->queued && !pool->stop && !(pool->closed && !pool->pending))
+        pthread_cond_wait(&pool->work, &pool->lock);
+    over = pool->stop || (pool->closed && !pool->pending);
+    pthread_mutex_unlock(&pool->lock);
+    return over;
+}
+
+/* the worker's own newest task, else the oldest one of another worker */
+struct task *find_task(struct worker *w) {
+    struct pool *pool = w->pool;
+    struct task *t;
+    int i, first;
+
+    t = deque_pop(&w->deque);
+    first = (int)(rand_r(&w->seed) % (unsigned)pool->num);
+    for (i = 0; !t && i < pool->num; i++) {
+        if ((first + i) % pool->num == w->id)
+            continue;
+        t = deque_steal(&pool->workers[(first + i) % pool->num].deque);
+        w->stolen += t != NULL;
+    }
+    if (t) {
+        pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return t;
+}
+
+/* closes whatever is still open and releases the file */
+void big_file_free(struct big_file *big) {
+    clear_temp_resources(&big->src, &big->tgt);
+    if (big->pool)
+        pool_release(big->pool, big->dir, big->name);
+    dir_put(big->dir);
+    free(big->crcs);
+    free(big);
+}
+
+/* opens a file of at least opts.chunk_min bytes and queues its chunks on
+ * this worker's deque, for it and any idle worker to take.
+ * returns 0 on success, 1 if the file was skipped and -1 on a fatal error */
+int split_file(struct worker *w, struct job *job) {
+    struct big_file *big;
+    struct task *t;
+    long long t_open;
+    size_t i;
+
+    big = (struct big_file *) calloc (1, sizeof(struct big_file));
+    if (!big) {
+        printf("ERROR: Failed to allocate memory\n");
+        return -1;
+    }
+    big->start = now_usec();
+    big->start_ns = trace_start();
+    if (opts.watch)
+        big->pool = w->pool;
+    dir_get(job->dir);
+    big->dir = job->dir;
+    memcpy(big->name, job->name, sizeof(big->name));
+    snprintf(big->rel, PATH_MAX, "%s%s%s",
+             big->dir->rel_path, big->dir->rel_path[0] ? "/" : "", big->name);
+    big->src.dir_path = big->dir->src_path;
+    big->tgt.dir_path = big->dir->tgt_path;
+    big->src.name = big->tgt.name = big->name;
+    big->src.id = big->tgt.id = -1;
+
+    t_open = trace_start();
+    big->src.id = openat(big->dir->src_fd, big->name, O_RDONLY);
+    if (big->src.id < 0) {
+        PR_FILE_ERR("Failed to open source file", &big->src);
+        big_file_free(big);
+        return 1;
+    }
+    if (fstat(big->src.id, &big->src.stats) || !big->src.stats.st_size ||
+        S_ISDIR(big->src.stats.st_mode)) {
+        printf("WARNING: File stats are bad for file [%s/%s]\n"
+               "Skipping file...\n"
+               "Cause: %s [%d]\n",
+               big->src.dir_path, big->name, strerror(errno), errno);
+        big_file_free(big);
+        return 1;
+    }
+    big->tgt.id = openat(big->dir->tgt_fd, big->name, O_WRONLY | O_CREAT | O_TRUNC, RW);
+    if (big->tgt.id < 0) {
+        PR_FILE_ERR("Failed to open target file", &big->tgt);
+        big_file_free(big);
+        return -1;
+    }
+
+    //chunks land out of order - the target must already have its final size
+    big->chunks = (size_t)((big->src.stats.st_size + (off_t)opts.chunk_size - 1) /
+                           (off_t)opts.chunk_size);
+    big->left = big->chunks;
+    if (opts.checksum)
+        big->crcs = (uint32_t (*)[2]) calloc (big->chunks, sizeof(*big->crcs));
+    if (size_target(&big->tgt, big->src.stats.st_size) || (opts.checksum && !big->crcs)) {
+        PR_FILE_ERR("Failed to encrypt file", &big->src);
+        big_file_free(big);
+        return -1;
+    }
+    trace_end(&big->src, PH_OPEN, t_open, 4);
+
+    //last chunk first, so the owner pops them in file order
+    for (i = big->chunks; i-- > 0;) {
+        t = task_create(TASK_CHUNK);
+        if (t) {
+            t->big = big;
+            t->index = i;
+        }
+        if (!t || task_push(w->pool, w, t)) {
+            printf("ERROR: Failed to queue chunks of file [%s/%s]\n",
+                   big->src.dir_path, big->name);
+            free(t);
+            __atomic_store_n(&big->rc, 1, __ATOMIC_RELAXED);
+            chunk_done(big, i + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* marks n chunks of big as finished. whoever finishes the last one closes
+ * the file and records it. returns -1 if that was a failed file */
+int chunk_done(struct big_file *big, size_t n) {
+    off_t len;
+    size_t i;
+    long long t;
+    int rc;
+
+    if (__atomic_sub_fetch(&big->left, n, __ATOMIC_ACQ_REL))
+        return 0;
+    rc = __atomic_load_n(&big->rc, __ATOMIC_RELAXED);
+
+    //stitch the chunk checksums together in file order
+    for (i = 0; !rc && big->crcs && i < big->chunks; i++) {
+        len = MIN((off_t)opts.chunk_size,
+                  big->src.stats.st_size - (off_t)i * (off_t)opts.chunk_size);
+        big->src.crc = crc32c_combine(big->src.crc, big->crcs[i][0], (uint64_t)len);
+        big->tgt.crc = crc32c_combine(big->tgt.crc, big->crcs[i][1], (uint64_t)len);
+    }
+
+    t = trace_start();
+    if (rc) {
+        printf("ERROR: Failed to encrypt file [%s/%s]\n", big->src.dir_path, big->name);
+        if (manifest)
+            manifest_drop(manifest, big->rel);
+    } else if (clear_temp_resources(&big->src, &big->tgt)) {
+        printf("ERROR: Failed to clean resources for files\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        rc = 1;
+    } else if (manifest && manifest_update(manifest, big->rel, &big->src.stats,
+                                           big->src.crc, big->tgt.crc)) {
+        rc = 1;
+    } else {
+        trace_end(&big->src, PH_CLOSE, t, 2);
+        log_latency(big->start);
+        trace_file(&big->src, big->rel, big->start_ns);
+    }
+    if (!rc)
+        big->src.id = big->tgt.id = -1;     //already closed
+    big_file_free(big);
+    return rc ? -1 : 0;
+}
+
+/* returns like encrypt_entry() - the worst outcome among the task's files */
+int run_task(struct worker *w, struct task *t) {
+    struct pool *pool = w->pool;
+    struct big_file *big = t->big;
+    struct job *job;
+    struct stat st;
+    off_t off;
+    int i, _rc, rc = 0;
+
+    if (t->type == TASK_CHUNK) {
+        off = (off_t)t->index * (off_t)opts.chunk_size;
+        if (!__atomic_load_n(&big->rc, __ATOMIC_RELAXED) &&
+            encrypt_range(&big->src, pool->key, &big->tgt, off,
+                          MIN((off_t)opts.chunk_size, big->src.stats.st_size - off),
+                          w->src->buf, big->crcs ? big->crcs[t->index] : NULL)) {
+            __atomic_store_n(&big->rc, 1, __ATOMIC_RELAXED);
+            rc = -1;
+        }
+        w->chunks++;
+        return chunk_done(big, 1) < 0 ? -1 : rc;
+    }
+
+    for (i = 0; i < t->count; i++) {
+        job = &t->jobs[i];
+        if (rc >= 0 && !__atomic_load_n(&pool->stop, __ATOMIC_RELAXED)) {
+            //unreadable entries are reported by encrypt_entry()
+            if (job->size < 0 && !opts.use_mmap && !opts.direct)
+                job->size = fstatat(job->dir->src_fd, job->name, &st, 0) ? 0 : st.st_size;
+            if (job->size >= 0 && (size_t)job->size >= opts.chunk_min &&
+                !opts.use_mmap && !opts.direct) {
+                _rc = split_file(w, job);       //its big_file_free() releases it
+            } else {
+                _rc = encrypt_entry(w->src, pool->key, w->tgt, job->dir, job->name);
+                w->files += !_rc;
+                if (pool->busy)
+                    pool_release(pool, job->dir, job->name);
+            }
+            rc = _rc < 0 ? -1 : rc | _rc;
+        }
+        dir_put(job->dir);
+    }
+    return rc;
+}
+
+void* worker_thread(void* void_worker) {
+    struct worker *w = (struct worker *)void_worker;
+    struct pool *pool = w->pool;
+    struct task *t;
+    long long start;
+    int _rc;
+
+    //the tasks left in the deque are dropped (and counted) by pool_finish()
+    if (key_stream_thread()) {
+        w->rc = 1;
+        pool_stop(pool);
+        pthread_exit(NULL);
+    }
+    for (;;) {
+        t = find_task(w);
+        if (!t) {
+            if (pool_wait(pool))
+                break;
+            continue;
+        }
+        start = now_usec();
+        _rc = run_task(w, t);
+        w->busy += now_usec() - start;
+        w->tasks++;
+        free(t);
+        task_done(pool);
+        if (_rc < 0) {
+            w->rc = 1;
+            pool_stop(pool);
+            break;
+        }
+        w->rc |= _rc;
+    }
+    pthread_exit(NULL);
+}
+
+/* queues the batch being filled on the next worker's deque, once there is
+ * room in the pool. returns 1 if the run was stopped and -1 on a fatal
+ * error (the batch is dropped either way) */
+int pool_flush(struct pool *pool) {
+    struct task *t = pool->batch;
+    int stopped;
+
+    if (!t)
+        return 0;
+    pool->batch = NULL;
+    pool->bytes = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending >= MAX_TASKS && !pool->stop)
+        pthread_cond_wait(&pool->room, &pool->lock);
+    stopped = pool->stop;
+    pthread_mutex_unlock(&pool->lock);
+    if (stopped) {
+        task_drop(t);
+        return 1;
+    }
+    if (task_push(pool, &pool->workers[pool->next % (size_t)pool->num], t)) {
+        printf("ERROR: Failed to queue files\n");
+        task_drop(t);
+        return -1;
+    }
+    pool->next++;
+    return 0;
+}
+
+/* adds an entry to the batch being filled (with -i, only if it changed).
+ * returns like pool_flush() */
+int pool_add(struct pool *pool, struct dir_node *dir, const char *name) {
+    char rel[PATH_MAX];
+    struct stat st;
+    struct job *job;
+
+    //the walk only stats what -i has to - sizing is left to the workers
+    st.st_size = -1;
+    if (opts.incremental && entry_unchanged(dir, name, rel, &st))
+        return 0;
+    //--watch: just created (or gone again) - its IN_CLOSE_WRITE is still to come
+    if (opts.watch && st.st_size <= 0)
+        return 0;
+    //--watch: a worker already has it - it goes again once that one is done
+    if (pool->busy && pool_claim(pool, rel))
+        return 0;
+
+    if (!pool->batch && !(pool->batch = task_create(TASK_FILES))) {
+        printf("ERROR: Failed to allocate memory\n");
+        return -1;
+    }
+    job = &pool->batch->jobs[pool->batch->count++];
+    dir_get(dir);
+    job->dir = dir;
+    strncpy(job->name, name, NAME_MAX);
+    job->name[NAME_MAX] = '\0';
+    job->size = st.st_size;
+    if (st.st_size > 0)
+        pool->bytes += (size_t)st.st_size;
+    if (pool->batch->count < BATCH_FILES && pool->bytes < BATCH_BYTES)
+        return 0;
+    return pool_flush(pool);
+}
+
+/*FNV-1a*/
+uint32_t busy_hash(const char *rel) {
+    uint32_t h = 2166136261U;
+
+    for (; *rel; rel++) {
+        h ^= (unsigned char)*rel;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* the in-flight slot of rel, or the free slot where it would go */
+struct busy_file *busy_lookup(struct pool *pool, const char *rel, uint32_t hash) {
+    size_t i = hash & (WATCH_BUSY - 1);
+
+    for (; pool->busy[i].rel; i = (i + 1) & (WATCH_BUSY - 1)) {
+        if (pool->busy[i].hash == hash && !strcmp(pool->busy[i].rel, rel))
+            return &pool->busy[i];
+    }
+    return &pool->busy[i];
+}
+
+/* --watch: adds rel to the in-flight set. returns 1 if it was in flight
+ * already - it is marked dirty instead */
+int pool_claim(struct pool *pool, const char *rel) {
+    struct busy_file *b;
+    uint32_t h = busy_hash(rel);
+    int busy;
+
+    pthread_mutex_lock(&pool->lock);
+    /**CS**/
+    b = busy_lookup(pool, rel, h);
+    busy = b->rel != NULL;
+    if (busy) {
+        b->dirty = 1;
+    } else if (2 * (pool->busy_count + 1) <= WATCH_BUSY && (b->rel = strdup(rel))) {
+        b->hash = h;
+        b->dirty = 0;
+        pool->busy_count++;
+    }
+    /**CS-END**/
+    pthread_mutex_unlock(&pool->lock);
+    return busy;
+}
+
+/* --watch: a worker is done with a file. takes it out of the in-flight
+ * set, or queues it again if it was written meanwhile */
+void pool_release(struct pool *pool, struct dir_node *dir, const char *name) {
+    char rel[PATH_MAX];
+    struct busy_file *b, moved;
+    struct task *t;
+    struct job *job;
+    uint32_t h;
+    size_t i;
+    int dirty;
+
+    snprintf(rel, PATH_MAX, "%s%s%s", dir->rel_path, dir->rel_path[0] ? "/" : "", name);
+    h = busy_hash(rel);
+    pthread_mutex_lock(&pool->lock);
+    /**CS**/
+    b = busy_lookup(pool, rel, h);
+    dirty = b->rel && b->dirty && !pool->stop;
+    if (dirty) {
+        b->dirty = 0;           //stays in flight, as the next task's
+    } else if (b->rel) {
+        //re-place the rest of its probe run
+        free(b->rel);
+        b->rel = NULL;
+        pool->busy_count--;
+        for (i = ((size_t)(b - pool->busy) + 1) & (WATCH_BUSY - 1); pool->busy[i].rel;
+             i = (i + 1) & (WATCH_BUSY - 1)) {
+            moved = pool->busy[i];
+            pool->busy[i].rel = NULL;
+            *busy_lookup(pool, moved.rel, moved.hash) = moved;
+        }
+    }
+    /**CS-END**/
+    pthread_mutex_unlock(&pool->lock);
+    if (!dirty)
+        return;
+
+    //any deque does - an idle worker steals it
+    t = task_create(TASK_FILES);
+    if (!t) {
+        printf("WARNING: Failed to queue file again [%s/%s]\n", dir->src_path, name);
+        return;
+    }
+    job = &t->jobs[t->count++];
+    dir_get(dir);
+    job->dir = dir;
+    strncpy(job->name, name, NAME_MAX);
+    job->name[NAME_MAX] = '\0';
+    job->size = -1;
+    if (task_push(pool, &pool->workers[0], t)) {
+        printf("WARNING: Failed to queue file again [%s/%s]\n", dir->src_path, name);
+        task_drop(t);
+    }
+}
+
+/* starts opts.jobs worker threads. returns 1 (with nothing left to finish)
+ * if they couldn't all be started */
+int pool_start(struct pool *pool, struct key *key) {
+    struct worker *workers;
+    int i;
+
+    memset(pool, 0, sizeof(struct pool));
+    workers = (struct worker *) calloc ((size_t)opts.jobs, sizeof(struct worker));
+    if (!workers || pthread_mutex_init(&pool->lock, NULL) ||
+        pthread_cond_init(&pool->work, NULL) || pthread_cond_init(&pool->room, NULL)) {
+        printf("ERROR: Failed to set up worker pool\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        free(workers);
+        return 1;
+    }
+    pool->workers = workers;
+    pool->num = opts.jobs;
+    pool->key = key;
+    if (opts.watch) {
+        pool->busy = (struct busy_file *) calloc (WATCH_BUSY, sizeof(struct busy_file));
+        if (!pool->busy) {
+            printf("ERROR: Failed to allocate memory\n");
+            pool_finish(pool, 1);
+            return 1;
+        }
+    }
+
+    //every deque must exist before anyone can steal from it
+    for (i = 0; i < opts.jobs; i++) {
+        workers[i].id = i;
+        workers[i].seed = (unsigned)i + 1;
+        workers[i].pool = pool;
+        workers[i].src = file_create();
+        workers[i].tgt = file_create();
+        if (!workers[i].src || !workers[i].tgt || deque_init(&workers[i].deque)) {
+            printf("ERROR: Failed to create worker %d\n"
+                   "Cause: %s [%d]\n",
+                   i, strerror(errno), errno);
+            file_destroy(workers[i].src);
+            file_destroy(workers[i].tgt);
+            pool_finish(pool, 1);
+            return 1;
+        }
+        pool->ready++;
+    }
+    pool->start = now_usec();
+    for (i = 0; i < opts.jobs; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i])) {
+            printf("ERROR: Failed to create worker %d\n"
+                   "Cause: %s [%d]\n",
+                   i, strerror(errno), errno);
+            pool_finish(pool, 1);
+            return 1;
+        }
+        pool->started++;
+    }
+    return 0;
+}
+
+/* queues the last batch (unless rc says the run failed), waits for the
+ * workers and reports how busy each one was. returns the run's rc */
+int pool_finish(struct pool *pool, int rc) {
+    struct worker *workers = pool->workers;
+    struct task *t;
+    long long wall;
+    int i;
+
+    if (rc) {
+        if (pool->batch)
+            task_drop(pool->batch);
+        pool->batch = NULL;
+        pool_stop(pool);
+    } else if (pool_flush(pool) < 0) {
+        rc = 1;
+        pool_stop(pool);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->closed = 1;
+    pthread_mutex_unlock(&pool->lock);
+    pthread_cond_broadcast(&pool->work);
+
+    for (i = 0; i < pool->started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        rc |= workers[i].rc;
+    }
+    wall = now_usec() - pool->start;
+
+    //per-worker utilization - low numbers mean workers starved for tasks
+    for (i = 0; i < pool->started; i++)
+        printf("Worker %d: %5.1f%% busy, %zu tasks (%zu stolen), %zu files, %zu chunks\n",
+               i, wall > 0 ? 100.0 * (double)workers[i].busy / (double)wall : 0.0,
+               workers[i].tasks, workers[i].stolen, workers[i].files, workers[i].chunks);
+
+    //drop tasks left behind by an aborted run
+    for (i = 0; i < pool->ready; i++) {
+        while ((t = deque_pop(&workers[i].deque)) != NULL) {
+            task_drop(t);
+            rc = 1;
+        }
+    }
+    for (i = 0; i < pool->ready; i++) {
+        deque_destroy(&workers[i].deque);
+        file_destroy(workers[i].src);
+        file_destroy(workers[i].tgt);
+    }
+    for (i = 0; pool->busy && i < WATCH_BUSY; i++)
+        free(pool->busy[i].rel);
+    free(pool->busy);
+    pthread_cond_destroy(&pool->room);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(workers);
+    return rc;
+}
+
+/*
+ * encrypts the walked tree with opts.jobs work-stealing threads. the walk
+ * hands out batches of small files round robin, and a worker that meets a
+ * file of at least opts.chunk_min bytes queues it as chunk tasks that idle
+ * workers steal - one huge file doesn't leave the other cores idle at the
+ * end of a run. every file still starts at key offset 0.
+ */
+int run_pool(struct key *key, struct walker *walker) {
+    struct pool pool;
+    struct dir_node *dir;
+    const char *name;
+    int _rc, rc = 0;
+
+    if (pool_start(&pool, key))
+        return 1;
+    while ((_rc = walker_next(walker, &dir, &name)) != 0) {
+        if (_rc < 0 || (_rc = pool_add(&pool, dir, name)) != 0) {
+            rc = _rc < 0;
+            break;
+        }
+    }
+    return pool_finish(&pool, rc);
+}
+
+/* --watch: starts watching a source dir, unless it already is */
+void watch_add(struct watch *w, struct dir_node *dir) {
+    struct dir_node **dirs;
+    int wd, cap;
+
+    wd = inotify_add_watch(w->fd, dir->src_path, WATCH_MASK);
+    if (wd < 0) {
+        printf("WARNING: Failed to watch dir [%s]\n"
+               "Cause: %s [%d]\n",
+               dir->src_path, strerror(errno), errno);
+        return;
+    }
+    if (wd >= w->cap) {
+        cap = w->cap ? w->cap : 64;
+        while (cap <= wd)
+            cap *= 2;
+        dirs = (struct dir_node **) realloc (w->dirs, (size_t)cap * sizeof(struct dir_node *));
+        if (!dirs) {
+            printf("WARNING: Failed to watch dir [%s]\n", dir->src_path);
+            inotify_rm_watch(w->fd, wd);
+            return;
+        }
+        memset(dirs + w->cap, 0, (size_t)(cap - w->cap) * sizeof(struct dir_node *));
+        w->dirs = dirs;
+        w->cap = cap;
+    }
+    //a rescan finds the same dirs again - keep the node we have
+    if (!w->dirs[wd]) {
+        dir_get(dir);
+        w->dirs[wd] = dir;
+    }
+}
+
+/* walker hook: every subdir a scan enters is watched */
+void watch_enter(void *arg, struct dir_node *dir) {
+    watch_add((struct watch *)arg, dir);
+}
+
+/* queues every file of the walk that changed since it was last encrypted,
+ * watching the dirs on the way. returns 0 when done, 1 if the pool was
+ * stopped and -1 on a fatal error */
+int watch_scan(struct watch *w, struct walker *walker) {
+    struct dir_node *dir;
+    const char *name;
+    int _rc;
+
+    walker->on_enter = watch_enter;
+    walker->arg = w;
+    while ((_rc = walker_next(walker, &dir, &name)) > 0) {
+        _rc = pool_add(w->pool, dir, name);
+        if (_rc)
+            return _rc;
+    }
+    return _rc;
+}
+
+/* scans a dir from scratch (taking over the caller's reference) - after
+ * an overflow, for the root, or for a subdir that just appeared */
+int watch_rescan(struct watch *w, struct dir_node *dir) {
+    struct walker walker;
+    int rc;
+
+    watch_add(w, dir);
+    if (walker_init(&walker, dir, opts.recursive))
+        return -1;
+    if (dir == w->root)
+        walker.skip_name = MANIFEST_NAME;
+    rc = watch_scan(w, &walker);
+    walker_destroy(&walker);
+    return rc;
+}
+
+/* remembers (wd, name) for the current read. returns 1 if it was there */
+int watch_coalesce(struct watch *w, int wd, const char *name) {
+    uint32_t h = 2166136261U ^ (uint32_t)wd;
+    const char *p;
+    size_t i;
+
+    for (p = name; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 16777619U;
+    }
+    for (i = h & (WATCH_SEEN - 1); w->seen[i].name; i = (i + 1) & (WATCH_SEEN - 1)) {
+        if (w->seen[i].wd == wd && !strcmp(w->seen[i].name, name))
+            return 1;
+    }
+    //a full table just stops coalescing until the next read
+    if (w->seen_count + 1 < WATCH_SEEN / 2) {
+        w->seen[i].wd = wd;
+        w->seen[i].name = name;
+        w->seen_count++;
+    }
+    return 0;
+}
+
+/* handles every event that is ready. returns like watch_scan() */
+int watch_drain(struct watch *w) {
+    struct inotify_event *ev;
+    struct dir_node *dir, *sub;
+    char *p;
+    ssize_t n;
+    int _rc;
+
+    for (;;) {
+        n = read(w->fd, w->buf, WATCH_BUF);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return 0;
+        if (n <= 0) {
+            printf("ERROR: Failed to read inotify events\n"
+                   "Cause: %s [%d]\n",
+                   strerror(errno), errno);
+            return -1;
+        }
+
+        //a file written in several opens shows up several times in one read
+        memset(w->seen, 0, WATCH_SEEN * sizeof(*w->seen));
+        w->seen_count = 0;
+
+        for (p = w->buf; p < w->buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                w->overflowed = 1;
+                continue;
+            }
+            dir = ev->wd >= 0 && ev->wd < w->cap ? w->dirs[ev->wd] : NULL;
+            if (!dir)
+                continue;
+            if (ev->mask & IN_IGNORED) {        //the dir is gone
+                dir_put(dir);
+                w->dirs[ev->wd] = NULL;
+                continue;
+            }
+            if (!ev->len || (dir == w->root && !strcmp(ev->name, MANIFEST_NAME)))
+                continue;
+
+            if (ev->mask & IN_ISDIR) {
+                //files may have landed before its watch was in place
+                if (!opts.recursive || dir_node_enter(dir, ev->name, &sub))
+                    continue;
+                _rc = watch_rescan(w, sub);
+            } else if (!(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) ||
+                       watch_coalesce(w, ev->wd, ev->name)) {
+                continue;           //IN_CREATE of a file - wait for its close
+            } else {
+                _rc = pool_add(w->pool, dir, ev->name);
+            }
+            if (_rc)
+                return _rc;
+        }
+    }
+}
+
+/*
+ * --watch: encrypts the tree once, then keeps encrypting files as they
+ * are written (IN_CLOSE_WRITE) or moved in (IN_MOVED_TO), on the -j pool,
+ * until SIGINT/SIGTERM. each burst of events is handed to the workers as
+ * soon as it is read. -i is implied, so the overflow rescan only costs a
+ * stat per file, and the manifest is saved on exit.
+ */
+int watch_tree(struct key *key, struct dir_node *root, struct walker *walker) {
+    struct watch w;
+    struct pool pool;
+    struct pollfd pfd[2];
+    struct signalfd_siginfo si;
+    sigset_t mask, old_mask;
+    int _rc, rc = 0;
+
+    memset(&w, 0, sizeof(struct watch));
+    w.root = root;
+    w.pool = &pool;
+    w.buf = (char *) malloc (WATCH_BUF);
+    w.seen = calloc (WATCH_SEEN, sizeof(*w.seen));
+
+    //blocked before the workers start, so they inherit it
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    pfd[0].fd = w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    pfd[1].fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    pfd[0].events = pfd[1].events = POLLIN;
+    if (!w.buf || !w.seen || w.fd < 0 || pfd[1].fd < 0) {
+        printf("ERROR: Failed to set up --watch\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        rc = 1;
+        goto cleanup;
+    }
+    if (pool_start(&pool, key)) {
+        rc = 1;
+        goto cleanup;
+    }
+
+    watch_add(&w, root);
+    _rc = watch_scan(&w, walker);
+    if (!_rc)
+        _rc = pool_flush(&pool);
+    if (!_rc) {
+        printf("Watching [%s] (Ctrl-C to stop)...\n", root->src_path);
+        fflush(stdout);
+    }
+
+    while (!_rc) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("ERROR: Failed to wait for events\n"
+                   "Cause: %s [%d]\n",
+                   strerror(errno), errno);
+            _rc = -1;
+            break;
+        }
+        //asked to stop - consume the signal, or unblocking it would kill us
+        if (pfd[1].revents) {
+            if (read(pfd[1].fd, &si, sizeof(si)) == sizeof(si))
+                printf("Stopping on %s...\n", strsignal((int)si.ssi_signo));
+            break;
+        }
+        _rc = watch_drain(&w);
+        if (!_rc && w.overflowed) {
+            printf("WARNING: inotify queue overflowed\n"
+                   "Rescanning [%s]...\n", root->src_path);
+            w.overflowed = 0;
+            dir_get(root);
+            _rc = watch_rescan(&w, root);
+        }
+        if (!_rc)
+            _rc = pool_flush(&pool);
+        fflush(stdout);
+    }
+    rc = pool_finish(&pool, _rc < 0);
+
+cleanup:
+    for (_rc = 0; _rc < w.cap; _rc++) {
+        if (w.dirs[_rc])
+            dir_put(w.dirs[_rc]);
+    }
+    if (w.fd >= 0)
+        close(w.fd);
+    if (pfd[1].fd >= 0)
+        close(pfd[1].fd);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    free(w.dirs);
+    free(w.seen);
+    free(w.buf);
+    return rc;
+}
+
+/* encrypts [off, off+len) of src into the same range of tgt. the key
+ * offset follows from the file offset, so ranges are independent.
+ * crc (if not NULL) receives the plain and cipher CRC32C of the range */
+int encrypt_range(struct file *src, struct key *key, struct file *tgt,
+                  off_t off, off_t len, char *buf, uint32_t *crc) {
+    struct key_stream ks;
+    ssize_t b_read, b_written;
+    long long t;
+    size_t n;
+
+    key_stream_init(&ks, key, off);
+    while (len > 0) {
+        n = (size_t)MIN((size_t)len, opts.buf_size);
+        t = trace_start();
+        b_read = pread(src->id, buf, n, off);
+        if (b_read <= 0) {
+            if (!b_read)        //file shrank under us
+                errno = ENODATA;
+            PR_FILE_ERR("Failed to read from file", src);
+            return EXIT_FAILURE;
+        }
+        trace_end(src, PH_READ, t, 1);
+        t = trace_start();
+        if (crc)
+            xor_crc32c(buf, buf, key_stream_next(&ks, (size_t)b_read), (size_t)b_read,
+                       &crc[0], &crc[1]);
+        else
+            xor_buf(buf, buf, key_stream_next(&ks, (size_t)b_read), (size_t)b_read);
+        trace_end(src, PH_XOR, t, 1);
+        t = trace_start();
+        b_written = pwrite(tgt->id, buf, (size_t)b_read, off);
+        if (b_written < b_read) {
+            PR_FILE_ERR("Failed to write to file", tgt);
+            return EXIT_FAILURE;
+        }
+        trace_end(src, PH_WRITE, t, 1);
+        off += b_read;
+        len -= b_read;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* stops every stage - each one notices at its next queue operation */
+void pipeline_fail(struct pipeline *p) {
+    atomic_store(&p->failed, 1);
+    spsc_wake(&p->free);
+    spsc_wake(&p->full);
+    spsc_wake(&p->done);
+}
+
+void* xor_stage(void* void_pipe) {
+    struct pipeline *p = (struct pipeline *)void_pipe;
+    struct pipe_block *b;
+    long long t;
+    size_t len;
+
+    if (key_stream_thread()) {
+        pipeline_fail(p);
+        return NULL;
+    }
+    while (!spsc_pop(&p->full, (void **)&b, &p->failed)) {
+        len = b->len;           //b may be recycled as soon as it is pushed
+        if (len) {
+            t = trace_start();
+            encrypt_block(p->src, p->tgt, b->buf, b->buf, key_stream_next(&p->ks, len), len);
+            trace_end(p->src, PH_XOR, t, 1);
+        }
+        spsc_push(&p->done, b);
+        if (!len)
+            break;
+    }
+    return NULL;
+}
+
+void* write_stage(void* void_pipe) {
+    struct pipeline *p = (struct pipeline *)void_pipe;
+    struct pipe_block *b;
+    ssize_t bytes_written;
+    long long t;
+
+    while (!spsc_pop(&p->done, (void **)&b, &p->failed) && b->len) {
+        t = trace_start();
+        bytes_written = write(p->tgt->id, b->buf, b->len);
+        if (bytes_written < (ssize_t)b->len) {
+            PR_FILE_ERR("Failed to write to file", p->tgt);
+            pipeline_fail(p);
+            break;
+        }
+        trace_end(p->src, PH_WRITE, t, 1);
+        spsc_push(&p->free, b);
+    }
+    return NULL;
+}
+
+/*
+ * --pipeline: the calling thread reads, a second thread XORs the blocks in
+ * place and a third writes them, so the device and the CPU both stay busy.
+ * PIPE_DEPTH blocks circulate through three SPSC queues; since no more
+ * blocks exist than a queue can hold, pushes never fail.
+ */
+int encrypt_file_pipelined(struct file *src, struct key *key, struct file *tgt) {
+    struct pipeline p;
+    struct pipe_block blocks[PIPE_DEPTH], *b;
+    pthread_t xor_thread, write_thread;
+    char *bufs;
+    ssize_t bytes_read;
+    long long t;
+    int i, rc = EXIT_SUCCESS;
 
-int encrypt_file(struct file *src, struct file *key, struct file *tgt);
+    if (posix_memalign((void **)&bufs, CACHE_LINE, PIPE_DEPTH * opts.buf_size))
+        return encrypt_file(src, key, tgt);
 
-int generate_key(struct file *key);
+    spsc_init(&p.free);
+    spsc_init(&p.full);
+    spsc_init(&p.done);
+    p.src = src;
+    p.tgt = tgt;
+    atomic_init(&p.failed, 0);
+    key_stream_init(&p.ks, key, 0);
+    for (i = 0; i < PIPE_DEPTH; i++) {
+        blocks[i].buf = bufs + (size_t)i * opts.buf_size;
+        spsc_push(&p.free, &blocks[i]);
+    }
 
-void usage(char* filename);
+    if (pthread_create(&xor_thread, NULL, xor_stage, &p)) {
+        free(bufs);
+        return encrypt_file(src, key, tgt);
+    }
+    if (pthread_create(&write_thread, NULL, write_stage, &p)) {
+        pipeline_fail(&p);
+        pthread_join(xor_thread, NULL);
+        free(bufs);
+        return encrypt_file(src, key, tgt);
+    }
 
-int is_ignored(char* filename);
+    //reader stage
+    while (!spsc_pop(&p.free, (void **)&b, &p.failed)) {
+        t = trace_start();
+        bytes_read = read(src->id, b->buf, opts.buf_size);
+        if (bytes_read < 0) {
+            PR_FILE_ERR("Failed to read from file", src);
+            pipeline_fail(&p);
+            break;
+        }
+        trace_end(src, PH_READ, t, 1);
+        b->len = (size_t)bytes_read;
+        spsc_push(&p.full, b);
+        if (!bytes_read)
+            break;
+    }
 
-int create_files(struct file **src,
-                   struct file **key,
-                   struct file **tgt,
-                   struct dir **src_dir,
-                   struct dir **tgt_dir);
+    pthread_join(xor_thread, NULL);
+    pthread_join(write_thread, NULL);
+    if (atomic_load(&p.failed))
+        rc = EXIT_FAILURE;
+    free(bufs);
+    return rc;
+}
 
-void destroy_files(struct file **src,
-                   struct file **key,
-                   struct file **tgt,
-                   struct dir **src_dir,
-                   struct dir **tgt_dir);
+static void uring_prep(struct io_uring_sqe *sqe, int op, int fd,
+                       const void *addr, unsigned len, off_t off, int slot) {
+    sqe->opcode = (__u8)op;
+    sqe->fd = fd;
+    sqe->addr = (__u64)(unsigned long)addr;
+    sqe->len = len;
+    sqe->off = (__u64)off;
+    sqe->user_data = (__u64)slot;
+}
 
-int clear_temp_resources(struct file *src,
-                         struct file *key,
-                         struct file *tgt);
-/***/
+/* queues the next operation for a slot, according to its state.
+ * fixed file 2*i is the slot's source, 2*i+1 its target */
+static void uring_slot_submit(struct uring *ring, struct uring_slot *slots, int i) {
+    struct uring_slot *slot = &slots[i];
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
 
-void usage(char* filename) {
-    printf("Usage: %s <%s> <%s> <%s>\n"
-           "Aborting...\n",
-            filename,
-            "source",
-            "key",
-            "target");
+    switch (slot->state) {
+    case SLOT_OPEN_SRC:
+        uring_prep(sqe, IORING_OP_OPENAT, slot->dir->src_fd, slot->name, 0, 0, i);
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = 2 * i + 1;
+        break;
+    case SLOT_READ:
+        uring_prep(sqe, IORING_OP_READ_FIXED, 2 * i, slot->buf,
+                   (unsigned)opts.buf_size, slot->off, i);
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->buf_index = (__u16)i;
+        break;
+    case SLOT_OPEN_TGT:
+        uring_prep(sqe, IORING_OP_OPENAT, slot->dir->tgt_fd, slot->name, RW, 0, i);
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        sqe->file_index = 2 * i + 2;
+        break;
+    case SLOT_WRITE:
+        uring_prep(sqe, IORING_OP_WRITE_FIXED, 2 * i + 1, slot->buf + slot->done,
+                   (unsigned)(slot->len - slot->done), slot->off + (off_t)slot->done, i);
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->buf_index = (__u16)i;
+        break;
+    case SLOT_CLOSE:
+        //the source is always open by now, the target may not be
+        uring_prep(sqe, IORING_OP_CLOSE, 0, NULL, 0, 0, i);
+        sqe->file_index = 2 * i + 1;
+        slot->pending = 1;
+        if (slot->tgt_open) {
+            sqe = uring_get_sqe(ring);
+            uring_prep(sqe, IORING_OP_CLOSE, 0, NULL, 0, 0, i);
+            sqe->file_index = 2 * i + 2;
+            slot->pending = 2;
+        }
+        break;
+    case SLOT_FREE:
+        break;
+    }
 }
 
-int create_files(struct file **src,
-                   struct file **key,
-                   struct file  **tgt,
-                   struct dir **src_dir,
-                   struct dir **tgt_dir) {
+/* -i: records (or forgets) a file the ring is done with */
+static void uring_slot_record(struct uring_slot *slot) {
+    char rel[PATH_MAX];
+
+    snprintf(rel, PATH_MAX, "%s%s%s", slot->dir->rel_path,
+             slot->dir->rel_path[0] ? "/" : "", slot->name);
+    if (slot->failed)
+        manifest_drop(manifest, rel);
+    else if (slot->off)
+        manifest_update(manifest, rel, &slot->stats, slot->crc[0], slot->crc[1]);
+}
+
+/* encrypts the walked tree with up to URING_DEPTH files in flight. opens,
+ * reads, writes and closes all go through one ring, into registered
+ * buffers and fixed (direct) descriptors.
+ * returns URING_NO_RING if the kernel can't run this engine */
+int encrypt_dir_uring(struct key *key, struct walker *walker) {
+    static const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ_FIXED,
+                               IORING_OP_WRITE_FIXED, IORING_OP_CLOSE };
+    struct uring ring;
+    struct uring_slot slots[URING_DEPTH];
+    struct iovec iovs[URING_DEPTH];
+    int files[2 * URING_DEPTH];
+    struct io_uring_cqe *cqe;
+    struct key_stream ks;
+    char *bufs = NULL;
+    struct dir_node *dir;
+    const char *name;
+    char rel[PATH_MAX];
+    int i, res, active = 0, eof = 0, stop = 0, rc = 0;
+    struct uring_slot *slot;
+
+    if (uring_init(&ring, 4 * URING_DEPTH))
+        return URING_NO_RING;
+    if (!uring_supports(&ring, ops, sizeof(ops) / sizeof(ops[0]))) {
+        uring_exit(&ring);
+        return URING_NO_RING;
+    }
+
+    //register one buffer per slot and an empty table of fixed files
+    if (posix_memalign((void **)&bufs, 4096, (size_t)URING_DEPTH * opts.buf_size)) {
+        uring_exit(&ring);
+        return URING_NO_RING;
+    }
+    memset(slots, 0, sizeof(slots));
+    for (i = 0; i < URING_DEPTH; i++) {
+        slots[i].buf = bufs + (size_t)i * opts.buf_size;
+        iovs[i].iov_base = slots[i].buf;
+        iovs[i].iov_len = opts.buf_size;
+        files[2 * i] = files[2 * i + 1] = -1;
+    }
+    if (uring_register(&ring, IORING_REGISTER_BUFFERS, iovs, URING_DEPTH) < 0 ||
+        uring_register(&ring, IORING_REGISTER_FILES, files, 2 * URING_DEPTH) < 0 ||
+        !uring_supports_direct(&ring)) {
+        free(bufs);
+        uring_exit(&ring);
+        return URING_NO_RING;
+    }
 
-    *src = (struct file *) malloc (sizeof(struct file));
-    *key = (struct file *) malloc (sizeof(struct file));
-    *tgt = (struct file *) malloc (sizeof(struct file));
-    *src_dir = (struct dir *) malloc (sizeof(struct dir));
-    *tgt_dir = (struct dir *) malloc (sizeof(struct dir));
+    for (;;) {
+        //start new files in the free slots
+        for (i = 0; i < URING_DEPTH && !eof && !stop; i++) {
+            if (slots[i].state != SLOT_FREE)
+                continue;
+            do {
+                res = walker_next(walker, &dir, &name);
+            } while (res > 0 && opts.incremental && entry_unchanged(dir, name, rel, &slots[i].stats));
+            if (res <= 0) {
+                eof = 1;
+                stop |= rc |= res < 0;
+                break;
+            }
+            //-i took the stats already
+            if (manifest && !opts.incremental && fstatat(dir->src_fd, name, &slots[i].stats, 0))
+                memset(&slots[i].stats, 0, sizeof(slots[i].stats));
+            dir_get(dir);
+            slots[i].dir = dir;
+            strncpy(slots[i].name, name, NAME_MAX);
+            slots[i].state = SLOT_OPEN_SRC;
+            slots[i].off = 0;
+            slots[i].tgt_open = 0;
+            slots[i].failed = 0;
+            slots[i].start = now_usec();
+            slots[i].crc[0] = slots[i].crc[1] = 0;
+            uring_slot_submit(&ring, slots, i);
+            active++;
+        }
+        if (!active)
+            break;
+
+        if (uring_submit_and_wait(&ring, 1) < 0) {
+            printf("ERROR: Failed to submit I/O\n"
+                   "Cause: %s [%d]\n",
+                   strerror(errno), errno);
+            rc = 1;
+            goto cleanup;
+        }
+
+        //advance every slot that has a completion
+        while ((cqe = uring_peek_cqe(&ring))) {
+            i = (int)cqe->user_data;
+            res = cqe->res;
+            uring_cqe_seen(&ring);
+            slot = &slots[i];
+
+            switch (slot->state) {
+            case SLOT_OPEN_SRC:
+                if (res < 0) {
+                    printf("ERROR: Failed to open source file [%s/%s]\n"
+                           "Cause: %s [%d]\n",
+                           slot->dir->src_path, slot->name, strerror(-res), -res);
+                    rc = 1;
+                    dir_put(slot->dir);
+                    slot->state = SLOT_FREE;
+                    active--;
+                    continue;
+                }
+                slot->state = SLOT_READ;
+                break;
+            case SLOT_READ:
+                //a symlink to a directory - skipped, as the other engines do
+                if (res == -EISDIR && !slot->off) {
+                    printf("WARNING: File stats are bad for file [%s/%s]\n"
+                           "Skipping file...\n"
+                           "Cause: %s [%d]\n",
+                           slot->dir->src_path, slot->name, strerror(-res), -res);
+                    rc = slot->failed = 1;
+                    slot->state = SLOT_CLOSE;
+                } else if (res < 0) {
+                    printf("ERROR: Failed to read from file [%s/%s]\n"
+                           "Cause: %s [%d]\n",
+                           slot->dir->src_path, slot->name, strerror(-res), -res);
+                    stop = rc = slot->failed = 1;
+                    slot->state = SLOT_CLOSE;
+                } else if (res == 0) {
+                    if (!slot->off) {
+                        printf("WARNING: File is empty [%s/%s]\n"
+                               "Skipping file...\n",
+                               slot->dir->src_path, slot->name);
+                        rc = 1;
+                        if (manifest) {
+                            snprintf(rel, PATH_MAX, "%s%s%s", slot->dir->rel_path,
+                                     slot->dir->rel_path[0] ? "/" : "", slot->name);
+                            entry_emptied(slot->dir, slot->name, rel);
+                        }
+                    }
+                    slot->state = SLOT_CLOSE;
+                } else {
+                    slot->len = (size_t)res;
+                    slot->done = 0;
+                    key_stream_init(&ks, key, slot->off);
+                    if (opts.checksum)
+                        xor_crc32c(slot->buf, slot->buf, key_stream_next(&ks, slot->len),
+                                   slot->len, &slot->crc[0], &slot->crc[1]);
+                    else
+                        xor_buf(slot->buf, slot->buf, key_stream_next(&ks, slot->len),
+                                slot->len);
+                    slot->state = slot->tgt_open ? SLOT_WRITE : SLOT_OPEN_TGT;
+                }
+                break;
+            case SLOT_OPEN_TGT:
+                if (res < 0) {
+                    printf("ERROR: Failed to open target file [%s/%s]\n"
+                           "Cause: %s [%d]\n",
+                           slot->dir->tgt_path, slot->name, strerror(-res), -res);
+                    stop = rc = slot->failed = 1;
+                    slot->state = SLOT_CLOSE;
+                    break;
+                }
+                slot->tgt_open = 1;
+                slot->state = SLOT_WRITE;
+                break;
+            case SLOT_WRITE:
+                if (res <= 0) {
+                    printf("ERROR: Failed to write to file [%s/%s]\n"
+                           "Cause: %s [%d]\n",
+                           slot->dir->tgt_path, slot->name, strerror(-res), -res);
+                    stop = rc = slot->failed = 1;
+                    slot->state = SLOT_CLOSE;
+                    break;
+                }
+                slot->done += (size_t)res;
+                if (slot->done == slot->len) {   //else write the rest
+                    slot->off += (off_t)slot->len;
+                    slot->state = SLOT_READ;
+                }
+                break;
+            case SLOT_CLOSE:
+                if (res < 0) {
+                    printf("ERROR: Failed to close files [%s]\n"
+                           "Cause: %s [%d]\n",
+                           slot->name, strerror(-res), -res);
+                    stop = rc = slot->failed = 1;
+                }
+                if (--slot->pending == 0) {
+                    if (manifest)
+                        uring_slot_record(slot);
+                    if (!slot->failed)
+                        log_latency(slot->start);
+                    dir_put(slot->dir);
+                    slot->state = SLOT_FREE;
+                    active--;
+                }
+                continue;
+            case SLOT_FREE:
+                continue;
+            }
+            uring_slot_submit(&ring, slots, i);
+        }
+    }
 
-    if ( !(*src) || !(*tgt) || !(*key) || !(*src_dir) || !(*tgt_dir) ) {
+cleanup:
+    //only reached with slots in flight if the ring itself failed
+    for (i = 0; i < URING_DEPTH; i++) {
+        if (slots[i].state != SLOT_FREE)
+            dir_put(slots[i].dir);
+    }
+    uring_exit(&ring);
+    free(bufs);
+    return rc;
+}
+
+int open_root(const char *src_path, const char *tgt_path, struct dir_node **root) {
+    int src_fd, tgt_fd;
+
+    //opens source dir
+    src_fd = open(src_path, O_RDONLY | O_DIRECTORY);
+    if (src_fd < 0) {
+        printf("ERROR: Failed to open dir [%s]\n"
+        "Cause: %s [%d]\n",
+        src_path, strerror(errno), errno);
         return 1;
     }
 
-    memset(*src, 0, sizeof(struct file));
-    memset(*tgt, 0, sizeof(struct file));
-    memset(*key, 0, sizeof(struct file));
-    memset(*src_dir, 0, sizeof(struct dir));
-    memset(*tgt_dir, 0, sizeof(struct dir));
+    //--pack has no target tree - the archive is opened by pack_tree()
+    if (opts.pack) {
+        tgt_fd = -1;
+        goto create;
+    }
+
+    //opens target dir (creates it if needed)
+    tgt_fd = open(tgt_path, O_RDONLY | O_DIRECTORY);
+    if (tgt_fd < 0 && errno == ENOENT && !mkdir(tgt_path, RW))
+        tgt_fd = open(tgt_path, O_RDONLY | O_DIRECTORY);
+    if (tgt_fd < 0) {
+        printf("ERROR: Failed to create dir [%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, strerror(errno), errno);
+        close(src_fd);
+        return 1;
+    }
 
+create:
+    *root = dir_node_create(src_fd, tgt_fd, src_path, tgt_path, "");
+    if (!*root) {
+        close(src_fd);
+        if (tgt_fd >= 0)
+            close(tgt_fd);
+        return 1;
+    }
     return 0;
 }
 
-void destroy_files(struct file **src,
-                   struct file **key,
-                   struct file **tgt,
-                   struct dir **src_dir,
-                   struct dir **tgt_dir) {
+/*
+ * --verify: checks every target recorded in the manifest against the
+ * CRC32C it was written with. only the targets are read, once - neither
+ * the sources nor the key are needed.
+ */
+int verify_target(const char *tgt_path) {
+    struct manifest *m;
+    struct manifest_entry *e;
+    char *buf = (char *) malloc (opts.buf_size);
+    size_t i, checked = 0, bad = 0;
+    off_t size;
+    uint32_t crc;
+    ssize_t n;
+    int tgt_fd, fd;
 
-    free(*src);
-    free(*key);
-    free(*tgt);
-    free(*src_dir);
-    free(*tgt_dir);
+    tgt_fd = open(tgt_path, O_RDONLY | O_DIRECTORY);
+    if (!buf || tgt_fd < 0) {
+        printf("ERROR: Failed to open dir [%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, strerror(errno), errno);
+        free(buf);
+        return 1;
+    }
+    if (faccessat(tgt_fd, MANIFEST_NAME, R_OK, 0) ||
+        !(m = manifest_load(tgt_fd, NULL, 0)) || !m->count) {
+        printf("ERROR: No checksums recorded for dir [%s]\n"
+               "Run with --checksum (or -i) to record them\n", tgt_path);
+        close(tgt_fd);
+        free(buf);
+        return 1;
+    }
+
+    for (i = 0; i < m->cap; i++) {
+        e = &m->slots[i];
+        if (!e->path)
+            continue;
+        checked++;
+        fd = openat(tgt_fd, e->path, O_RDONLY);
+        if (fd < 0) {
+            printf("ERROR: Failed to open target file [%s/%s]\n"
+                   "Cause: %s [%d]\n",
+                   tgt_path, e->path, strerror(errno), errno);
+            bad++;
+            continue;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        crc = 0;
+        size = 0;
+        while ((n = read(fd, buf, opts.buf_size)) > 0) {
+            crc = crc32c(crc, buf, (size_t)n);
+            size += n;
+        }
+        if (n < 0) {
+            printf("ERROR: Failed to read from file [%s/%s]\n"
+                   "Cause: %s [%d]\n",
+                   tgt_path, e->path, strerror(errno), errno);
+            bad++;
+        } else if (size != e->size || crc != e->cipher_crc) {
+            printf("ERROR: Checksum mismatch [%s/%s]\n", tgt_path, e->path);
+            bad++;
+        }
+        close(fd);
+    }
+    printf("Verified %zu files in [%s]: %zu bad\n", checked, tgt_path, bad);
 
+    manifest_free(m);
+    close(tgt_fd);
+    free(buf);
+    return bad != 0;
 }
 
-int clear_temp_resources(struct file *src,
-                         struct file *key,
-                         struct file *tgt) {
+/*
+ * --pack: appends every walked file to one archive instead of creating a
+ * target per source, then writes the index (see pack.h). a payload holds
+ * exactly what the file's own target would, and is found again by name.
+ */
+int pack_tree(struct file *src, struct key *key, struct file *tgt,
+              struct walker *walker, const char *archive_path) {
+    struct pack_writer w;
+    struct stat arch_st;
+    struct dir_node *dir;
+    const char *name;
+    char rel[PATH_MAX];
+    long long start;
+    off_t end;
+    int _rc, rc = 0;
 
-    int _rc = 0;
-    if (lseek(key->id, 0, SEEK_SET) < 0)
-        _rc = 1;
-    _rc |= close(src->id);
-    _rc |= close(tgt->id);
-    free(src->path);
-    free(tgt->path);
-    return _rc;
+    tgt->dir_path = ".";
+    tgt->name = archive_path;
+    tgt->id = open(archive_path, O_WRONLY | O_CREAT | O_TRUNC, RW);
+    if (tgt->id < 0 || fstat(tgt->id, &arch_st) || pack_begin(&w, tgt->id)) {
+        printf("ERROR: Failed to create archive [%s]\n"
+               "Cause: %s [%d]\n",
+               archive_path, strerror(errno), errno);
+        return 1;
+    }
+
+    while ((_rc = walker_next(walker, &dir, &name)) > 0) {
+        start = now_usec();
+        snprintf(rel, PATH_MAX, "%s%s%s", dir->rel_path, dir->rel_path[0] ? "/" : "", name);
+        src->dir_path = dir->src_path;
+        src->name = name;
+        src->crc = tgt->crc = 0;
+
+        src->id = openat(dir->src_fd, name, O_RDONLY);
+        if (src->id < 0) {
+            PR_FILE_ERR("Failed to open source file", src);
+            rc = 1;
+            continue;
+        }
+        if (fstat(src->id, &src->stats) ||
+            (src->stats.st_dev == arch_st.st_dev && src->stats.st_ino == arch_st.st_ino)) {
+            close(src->id);     //the archive itself, inside the source dir
+            continue;
+        }
+        if (!src->stats.st_size || S_ISDIR(src->stats.st_mode)) {
+            printf("WARNING: File stats are bad for file [%s/%s]\n"
+                   "Skipping file...\n",
+                   src->dir_path, name);
+            close(src->id);
+            rc = 1;
+            continue;
+        }
+
+        //payloads go back to back, each from key offset 0
+        if (lseek(tgt->id, (off_t)w.end, SEEK_SET) < 0 ||
+            encrypt_file(src, key, tgt) ||
+            (end = lseek(tgt->id, 0, SEEK_CUR)) < 0 ||
+            pack_add(&w, rel, (uint64_t)end - w.end, tgt->crc)) {
+            PR_FILE_ERR("Failed to pack file", src);
+            close(src->id);
+            _rc = -1;
+            break;
+        }
+        close(src->id);
+        log_latency(start);
+    }
+    if (_rc < 0)
+        rc = 1;
+
+    //an archive without its index is useless - write it unless we failed midway
+    if (_rc >= 0 && pack_finish(&w)) {
+        printf("ERROR: Failed to write index of archive [%s]\n"
+               "Cause: %s [%d]\n",
+               archive_path, strerror(errno), errno);
+        rc = 1;
+    }
+    if (close(tgt->id))
+        rc = 1;
+    tgt->id = -1;
+    if (_rc >= 0)
+        printf("Packed %zu files into [%s]\n", w.count, archive_path);
+    pack_writer_free(&w);
+    return rc;
 }
 
-int generate_key(struct file *key) {
-    int i, b_read = 0;
-    char ch_buf;
+/* names come from the archive - keep them inside the target dir */
+int member_name_ok(const char *name) {
+    const char *p = name, *end;
 
-    for(i=0; i < BUF_SIZE;) {
-        b_read = read(key->id, &ch_buf, sizeof(char));
-        if (b_read < 0) { //error on read
-            printf("ERROR: Failed to read from file [%s]\n"
+    if (!*name || *name == '/')
+        return 0;
+    for (; *p; p = *end ? end + 1 : end) {
+        end = strchrnul(p, '/');
+        if (end == p || (end - p == 1 && p[0] == '.') ||
+            (end - p == 2 && p[0] == '.' && p[1] == '.'))
+            return 0;
+    }
+    return 1;
+}
+
+/* decrypts one member into tgt (already open), checking the stored CRC32C */
+int extract_member(struct pack_reader *r, struct pack_member *m,
+                   struct key *key, struct file *tgt) {
+    struct key_stream ks;
+    uint64_t done;
+    uint32_t crc = 0;
+    size_t n, w;
+    ssize_t b;
+
+    key_stream_init(&ks, key, 0);
+    for (done = 0; done < m->len; done += n) {
+        n = (size_t)MIN(m->len - done, (uint64_t)opts.buf_size);
+        b = pread(r->fd, tgt->buf, n, (off_t)(m->off + done));
+        if (b <= 0) {
+            if (!b)             //archive cut short
+                errno = ENODATA;
+            printf("ERROR: Failed to read [%s] from archive\n"
                    "Cause: %s [%d]\n",
-                   key->path, strerror(errno), errno);
-            return EXIT_FAILURE;
+                   m->name, strerror(errno), errno);
+            return 1;
         }
-        else {
-            if (b_read == 0) {    //reach EOF
-                if (lseek(key->id, 0, SEEK_SET) < 0) {
-                    printf("ERROR: Failed to reset offset in file [%s]\n"
-                           "Cause: %s [%d]\n",
-                           key->path, strerror(errno), errno);
-                    return 1;
-                }
-            } else                //read is ok
-                key->buf[i++] = ch_buf;
+        n = (size_t)b;
+        crc = crc32c(crc, tgt->buf, n);
+        xor_buf(tgt->buf, tgt->buf, key_stream_next(&ks, n), n);
+
+        //the target may be stdout
+        for (w = 0; w < n; w += (size_t)b) {
+            b = write(tgt->id, tgt->buf + w, n - w);
+            if (b < 0 && errno == EINTR) {
+                b = 0;
+                continue;
+            }
+            if (b <= 0) {
+                PR_FILE_ERR("Failed to write to file", tgt);
+                return 1;
+            }
         }
     }
-    return EXIT_SUCCESS;
+    if (crc != m->crc) {
+        printf("ERROR: Checksum mismatch [%s]\n", m->name);
+        return 1;
+    }
+    return 0;
 }
 
-int encrypt_file(struct file *src, struct file *key, struct file *tgt) {
+/* opens an archive and reads its footer. returns -1 on failure */
+int open_archive(struct pack_reader *r, const char *archive_path) {
+    int fd = open(archive_path, O_RDONLY);
 
-    ssize_t bytes_read, bytes_needed, bytes_written;
-    bytes_needed = sizeof(src->buf);
-    int i;
+    if (fd < 0 || pack_open(r, fd)) {
+        printf("ERROR: Failed to open archive [%s]\n"
+               "Cause: %s [%d]\n",
+               archive_path, strerror(errno), errno);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-    while((bytes_read = read(src->id, src->buf,(size_t)bytes_needed)) > 0) {
+/* --unpack: decrypts every member of an archive into a target dir */
+int unpack_archive(struct key *key, struct file *tgt,
+                   const char *archive_path, const char *tgt_path) {
+    struct pack_reader r;
+    struct pack_member m;
+    uint64_t i;
+    size_t bad = 0;
+    char *slash;
+    int tgt_fd, rc = 0;
 
-        //generate key   
-        if (generate_key(key)) {
-            printf("ERROR: Failed to generate key from file [%s]\n"
+    if (open_archive(&r, archive_path) < 0)
+        return 1;
+    tgt_fd = open(tgt_path, O_RDONLY | O_DIRECTORY);
+    if (tgt_fd < 0 && errno == ENOENT && !mkdir(tgt_path, RW))
+        tgt_fd = open(tgt_path, O_RDONLY | O_DIRECTORY);
+    if (tgt_fd < 0) {
+        printf("ERROR: Failed to create dir [%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, strerror(errno), errno);
+        close(r.fd);
+        return 1;
+    }
+
+    tgt->dir_path = tgt_path;
+    for (i = 0; i < r.foot.count; i++) {
+        if (pack_member_at(&r, i, &m)) {
+            printf("ERROR: Failed to read index of archive [%s]\n"
                    "Cause: %s [%d]\n",
-                   key->path, strerror(errno), errno);
-            return EXIT_FAILURE;
+                   archive_path, strerror(errno), errno);
+            rc = 1;
+            break;
+        }
+        tgt->name = m.name;
+        if (!member_name_ok(m.name)) {
+            printf("ERROR: Bad name in archive [%s]\n", m.name);
+            bad++;
+            continue;
         }
 
-        //encrypt bytes into tgt buffer
-        for (i=0; i < bytes_read; i++) {
-            tgt->buf[i] = src->buf[i] ^ key->buf[i];
+        //-r archives hold relative paths - recreate their dirs
+        for (slash = strchr(m.name, '/'); slash; slash = strchr(slash + 1, '/')) {
+            *slash = '\0';
+            if (mkdirat(tgt_fd, m.name, RW) && errno != EEXIST)
+                break;
+            *slash = '/';
+        }
+        if (slash)
+            *slash = '/';
+        tgt->id = openat(tgt_fd, m.name, O_WRONLY | O_CREAT | O_TRUNC, RW);
+        if (tgt->id < 0) {
+            PR_FILE_ERR("Failed to open target file", tgt);
+            bad++;
+            continue;
+        }
+        bad += extract_member(&r, &m, key, tgt) != 0;
+        if (close(tgt->id)) {
+            PR_FILE_ERR("Failed to close file", tgt);
+            bad++;
         }
+        tgt->id = -1;
+    }
+    if (!rc)
+        printf("Unpacked %llu files into [%s]: %zu bad\n",
+               (unsigned long long)r.foot.count, tgt_path, bad);
 
-        //write buffer into file
-        bytes_written = write(tgt->id, tgt->buf, (size_t)bytes_read);
-        if (bytes_written < bytes_read) {
-            printf("ERROR: Failed to write to file [%s]\n"
+    close(tgt_fd);
+    close(r.fd);
+    return rc || bad;
+}
+
+/* --extract: decrypts the one member called name, found through the index */
+int extract_file(struct key *key, struct file *tgt, const char *archive_path,
+                 const char *name, const char *tgt_path, int out_fd) {
+    struct pack_reader r;
+    struct pack_member m;
+    int rc;
+
+    if (open_archive(&r, archive_path) < 0)
+        return 1;
+    rc = pack_find(&r, name, &m);
+    if (rc) {
+        if (rc < 0)
+            printf("ERROR: Failed to read index of archive [%s]\n"
                    "Cause: %s [%d]\n",
-                   tgt->path, strerror(errno), errno);
-            return EXIT_FAILURE;
-        }
-        
+                   archive_path, strerror(errno), errno);
+        else
+            printf("ERROR: No file [%s] in archive [%s]\n", name, archive_path);
+        close(r.fd);
+        return 1;
     }
 
-    if (bytes_read < 0) { //ended with read error
-        printf("ERROR: Failed to read from file [%s]\n"
-               "Cause: %s [%d]\n",
-               src->path, strerror(errno), errno);
-        return EXIT_FAILURE;
+    tgt->dir_path = ".";
+    tgt->name = strcmp(tgt_path, "-") ? tgt_path : "stdout";
+    tgt->id = strcmp(tgt_path, "-") ? open(tgt_path, O_WRONLY | O_CREAT | O_TRUNC, RW)
+                                    : out_fd;
+    if (tgt->id < 0) {
+        PR_FILE_ERR("Failed to open target file", tgt);
+        close(r.fd);
+        return 1;
     }
-    return EXIT_SUCCESS;
+    rc = extract_member(&r, &m, key, tgt);
+    if (close(tgt->id)) {
+        PR_FILE_ERR("Failed to close file", tgt);
+        rc = 1;
+    }
+    tgt->id = -1;
+    close(r.fd);
+    return rc;
 }
 
-int is_ignored(char* filename) {
-    char *ignored[] = { ".", ".."};
-    int length = 2;
-    int i;
+/* --range: decrypts len bytes at off of one target to stdout, reading
+ * nothing else - the key offset follows from off */
+int decrypt_range(struct key *key, struct file *tgt, const char *path,
+                  const char *off_str, const char *len_str, int out_fd) {
+    size_t off, len, n, w;
+    ssize_t b;
+    int fd;
+
+    if (parse_size(off_str, &off) || parse_size(len_str, &len)) {
+        printf("ERROR: Invalid range [%s %s]\n", off_str, len_str);
+        return 1;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("ERROR: Failed to open file [%s]\n"
+               "Cause: %s [%d]\n",
+               path, strerror(errno), errno);
+        return 1;
+    }
+    tgt->dir_path = ".";
+    tgt->name = "stdout";
+    tgt->id = out_fd;
 
-    for (i=0; i<length; i++) {
-        if(!strcmp(filename, ignored[i]))
+    for (; len > 0; len -= n, off += n) {
+        n = MIN(len, opts.buf_size);
+        b = opts.chacha ? range_pread_chacha(fd, tgt->buf, n, (off_t)off, &key->chacha)
+                        : range_pread(fd, tgt->buf, n, (off_t)off, key->tile, key->size);
+        if (b < 0) {
+            printf("ERROR: Failed to read from file [%s]\n"
+                   "Cause: %s [%d]\n",
+                   path, strerror(errno), errno);
+            close(fd);
             return 1;
+        }
+        n = (size_t)b;
+        if (!n)
+            break;              //the range ends past the end of the file
+        for (w = 0; w < n; w += (size_t)b) {
+            b = write(out_fd, tgt->buf + w, n - w);
+            if (b < 0 && errno == EINTR) {
+                b = 0;
+                continue;
+            }
+            if (b <= 0) {
+                PR_FILE_ERR("Failed to write to file", tgt);
+                close(fd);
+                return 1;
+            }
+        }
     }
+    close(fd);
     return 0;
 }
 
 int main ( int argc, char *argv[]) {
 
-    //validate 3 command line arguments given
-    if (argc != 4) {
+    //validate 3 command line arguments given (after options) - 1 for --verify
+    if (parse_options(argc, argv) || argc - optind != (opts.verify ? 1 : 3)) {
         usage(argv[0]);
         goto exit;
     }
+    argv += optind - 1;                 //positional arguments are now argv[1..3]
+
+    if (opts.verify) {
+        crc32c_init();
+        return verify_target(argv[1]) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
     //declerations:
-    struct file *src, *tgt, *key;
-    struct dir *src_dir, *tgt_dir;
+    struct file *src, *tgt;
+    struct key *key;
+    struct dir_node *root = NULL, *dir;
+    struct walker walker;
+    const char *name;
+    int walking = 0, walked = 0, out_fd = -1;
+    long long start = now_nsec();
     int rc = 0, _rc = 0;
-    mode_t RO = S_IRUSR | S_IRGRP | S_IROTH;
-    mode_t RW = S_IRWXU | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
-    char path_buf[BUF_SIZE];
-    create_files(&src, &key, &tgt, &src_dir, &tgt_dir);
 
-    //open key file (if exist)
-    key->path = strdup(argv[2]);
+    //stdout carries the stream - messages go to stderr instead
+    if (opts.range || ((opts.streaming || opts.extract) && !strcmp(argv[3], "-"))) {
+        out_fd = dup(STDOUT_FILENO);
+        if (out_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            perror("dup");
+            return EXIT_FAILURE;
+        }
+    }
+    if (create_files(&src, &key, &tgt)) {
+        printf("ERROR: Failed to allocate file contexts\n");
+        destroy_files(&src, &key, &tgt);
+        return EXIT_FAILURE;
+    }
+    xor_init();
+    crc32c_init();
+
+    if (opts.stats) {
+        run_stats = stats_open(stderr);
+        if (!run_stats) {
+            printf("ERROR: Failed to allocate memory\n");
+            rc = 1;
+            goto cleanup;
+        }
+    }
+    if (opts.latency_log) {
+        latency_log = fopen(opts.latency_log, "w");
+        if (!latency_log) {
+            printf("ERROR: Failed to open file [%s]\n"
+                   "Cause: %s [%d]\n",
+                   opts.latency_log, strerror(errno), errno);
+            rc = 1;
+            goto cleanup;
+        }
+    }
+
+    //open key file (if exist) - it comes last after --range FILE <off> <len>
+    key->path = strdup(opts.range ? argv[3] : argv[2]);
     key->id = open(key->path, (int)RO);
     if (key->id < 0) {
         printf("ERROR: Failed to open file [%s]\n"
@@ -227,119 +3343,124 @@ int main ( int argc, char *argv[]) {
         rc = 1;
         goto cleanup;    
     }
-
-    //opens source dir
-    src_dir->path = strdup(argv[1]);
-    src_dir->id = opendir(src_dir->path);
-    if (!src_dir->id) {
-        printf("ERROR: Failed to open dir [%s]\n"
-        "Cause: %s [%d]\n",
-        src_dir->path, strerror(errno), errno);            
+    if (load_key(key)) {
         rc = 1;
         goto cleanup;
     }
 
-    //opens target dir
-    tgt_dir->path = strdup(argv[3]);
-    tgt_dir->id = opendir(tgt_dir->path);
-    if (!tgt_dir->id) {
-        rc = mkdir(tgt_dir->path, RW);
-        if (rc) {
-            printf("ERROR: Failed to create dir [%s]\n"
-                   "Cause: %s [%d]\n",
-                   tgt_dir->path, strerror(errno), errno);
-            rc = 1;
-            goto cleanup;
-        }
+    if (opts.range) {
+        rc = decrypt_range(key, tgt, opts.range, argv[1], argv[2], out_fd);
+        goto cleanup;
+    }
+    if (opts.unpack) {
+        rc = unpack_archive(key, tgt, argv[1], argv[3]);
+        goto cleanup;
+    }
+    if (opts.extract) {
+        rc = extract_file(key, tgt, argv[1], opts.extract, argv[3], out_fd);
+        goto cleanup;
     }
 
-    //iterate over src dir files
-    while ((src_dir->entry = readdir(src_dir->id))) {
-
-        //get file's path
-        if(is_ignored(src_dir->entry->d_name))
-            continue;
-        sprintf(path_buf, "%s/%s", src_dir->path, src_dir->entry->d_name);
-        src->path = strdup(path_buf);
-        sprintf(path_buf, "%s/%s", tgt_dir->path, src_dir->entry->d_name);
-        tgt->path = strdup(path_buf);
-
-        //open source file
-        src->id = open(src->path,(int)RO);
-        if (src->id < 0) {
-            printf("ERROR: Failed to open source file [%s]\n"
-                   "Cause: %s [%d]\n",
-                   src->path, strerror(errno), errno);
-            clear_temp_resources(src, key, tgt);
+    if (opts.streaming) {
+        if (open_stream(src, tgt, argv[1], argv[3], out_fd) ||
+            encrypt_stream(src, key, tgt))
             rc = 1;
-            continue;
-        }
-        if(stat(src->path, &src->stats) || !src->stats.st_size) {
-            printf("WARNING: File stats are bad for file [%s]\n"
-                   "Skipping file...\n"
+        if (clear_temp_resources(src, tgt)) {
+            printf("ERROR: Failed to close stream\n"
                    "Cause: %s [%d]\n",
-                   src->path, strerror(errno), errno);
-            clear_temp_resources(src, key, tgt);
+                   strerror(errno), errno);
             rc = 1;
-            continue;
         }
+        goto cleanup;
+    }
 
-        //open target file
-        tgt->id = creat(tgt->path, RW);
-        if (tgt->id < 0) {
-            printf("ERROR: Failed to open target file [%s]\n"
-                   "Cause: %s [%d]\n",
-                   tgt->path, strerror(errno), errno);
-            clear_temp_resources(src, key, tgt);
-            rc = 1;
-            goto cleanup;
-        }
-        if (lseek(tgt->id, 0, SEEK_SET) < 0) { //overwrite if file exist
-            printf("ERROR: Failed to reset offset in file [%s]\n"
-                   "Cause: %s [%d]\n",
-                   tgt->path, strerror(errno), errno);
-            clear_temp_resources(src, key, tgt);
+    //opens source and target dirs, and starts walking the source
+    if (open_root(argv[1], argv[3], &root))  {
+        rc = 1;
+        goto cleanup;
+    }
+    dir_get(root);                      //kept for the manifest
+    if (walker_init(&walker, root, opts.recursive)) {
+        rc = 1;
+        goto cleanup;
+    }
+    walker.skip_name = MANIFEST_NAME;
+    walking = 1;
+
+    if (opts.pack) {
+        rc = pack_tree(src, key, tgt, &walker, argv[3]);
+        goto cleanup;
+    }
+
+    if (opts.checksum) {
+        manifest = manifest_load(root->tgt_fd, &key->stats,
+                                 opts.chacha ? KEY_MODE_CHACHA : KEY_MODE_TILE);
+        if (!manifest) {
+            printf("ERROR: Failed to load manifest of dir [%s]\n", root->tgt_path);
             rc = 1;
             goto cleanup;
         }
+    }
 
-        //encrypt file
-        rc = encrypt_file(src, key, tgt);
-        if (rc) {
-            printf("ERROR: Failed to encrypt file [%s]\n"
-                   "Cause: %s [%d]\n",
-                   src->path, strerror(errno), errno);
-            clear_temp_resources(src, key, tgt);
+    //hand the files over to the workers
+    if (opts.watch) {
+        rc = watch_tree(key, root, &walker);
+        goto cleanup;
+    }
+    if (opts.jobs > 1) {
+        rc = run_pool(key, &walker);
+        goto cleanup;
+    }
+    if (opts.use_uring) {
+        rc = encrypt_dir_uring(key, &walker);
+        if (rc != URING_NO_RING)
             goto cleanup;
-        }
+        printf("WARNING: io_uring is unavailable\n"
+               "Falling back to synchronous I/O...\n");
+        rc = 0;
+    }
 
-        //reset conditions
-        rc = clear_temp_resources(src, key, tgt);
-        if (rc) {
-            printf("ERROR: Failed to clean resources for files\n"
-                   "Cause: %s [%d]\n",
-                   strerror(errno), errno);
-            goto cleanup;
-        }
+    //iterate over src tree files
+    while ((_rc = walker_next(&walker, &dir, &name)) > 0) {
+        _rc = encrypt_entry(src, key, tgt, dir, name);
+        if (_rc < 0)
+            break;
+        rc |= _rc;
     }
+    if (_rc < 0)
+        rc = 1;
+    _rc = 0;
 
 cleanup:
+    if (walking) {
+        rc |= walker.rc;
+        //skipped files were still marked seen - only a dir left unlisted hides sources
+        walked = walker.done && !walker.incomplete;
+        walker_destroy(&walker);
+    }
+    if (manifest) {
+        if (walked && opts.incremental)
+            rc |= manifest_prune(manifest, root->tgt_fd, root->tgt_path, opts.recursive);
+        rc |= manifest_save(manifest, root->tgt_fd, root->tgt_path);
+        manifest_free(manifest);
+    }
+    if (root)
+        dir_put(root);
+    if (latency_log && fclose(latency_log))
+        rc = 1;
+    if (run_stats && stats_close(run_stats, (uint64_t)(now_nsec() - start)))
+        rc = 1;
+    unload_key(key);
     free(key->path);
-    free(src_dir->path);
-    free(tgt_dir->path);
     if (key->id)
         _rc = close(key->id);
-    if (src_dir->id)
-        _rc |= closedir(src_dir->id);
-    if (tgt_dir->id)
-        _rc |= closedir(tgt_dir->id);
     if (_rc) {
         printf("ERROR: Failed to close files on exit\n"
                "Cause: %s [%d]\n",
                strerror(errno), errno);
         rc = 1;
     }
-    destroy_files(&src, &key, &tgt, &src_dir, &tgt_dir);
+    destroy_files(&src, &key, &tgt);
 exit:
     return (rc ? EXIT_FAILURE: EXIT_SUCCESS);
 }
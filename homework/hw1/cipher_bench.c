@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<math.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<limits.h>
+#include<dirent.h>
+#include<ftw.h>
+#include<libgen.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<sys/resource.h>
+
+/*
+ * Throughput benchmark for ./cipher.
+ *
+ * Builds synthetic source trees under work_dir (many tiny files, a few huge
+ * files, and a mixed log-uniform size distribution), then runs cipher over
+ * each of them for every key size and buffer size, once with a cold page
+ * cache and once warm. Every run is a forked child, so its rusage and its
+ * read/write syscall counts (from /proc/self/io, which picks up reaped
+ * children) are exact. Per-file latencies come from --latency-log.
+ *
+ * Extra arguments are handed to cipher as-is (e.g. "-j 8" or "--uring"), so
+ * engines can be compared on the same data.
+ */
+
+#define MB              (1UL << 20)
+#define TINY_MIN        64
+#define TINY_MAX        4096
+#define HUGE_FILES      2
+#define MIXED_MIN       64
+#define MIXED_MAX       (16 * MB)
+#define GEN_BUF_SIZE    MB
+#define MAX_ARGS        64
+
+struct dataset {
+    const char *name;
+    size_t files;
+    size_t bytes;
+};
+
+struct io_counters {
+    unsigned long long syscr;
+    unsigned long long syscw;
+};
+
+struct result {
+    double seconds;
+    double user;                //child cpu seconds
+    double sys;
+    unsigned long long syscalls;
+    long long p50;              //per-file latency, usec
+    long long p99;
+};
+
+static const size_t key_sizes[] = { 1, 4096, MB, 64 * MB, 1024 * MB };
+static const size_t buf_sizes[] = { 4096, 64 * 1024, MB };
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+void usage(char* filename);
+double now_sec(void);
+unsigned long long rng_next(void);
+size_t rng_log_uniform(size_t lo, size_t hi);
+int write_random_file(const char *path, size_t size);
+int make_dataset(const char *work_dir, struct dataset *ds, size_t budget);
+int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw);
+int remove_tree(const char *path);
+int read_io_counters(struct io_counters *c);
+int drop_caches(const char *src_dir, const char *key_path);
+int run_cipher(char *const argv[], struct result *res);
+int cmp_ll(const void *a, const void *b);
+int read_latencies(const char *path, struct result *res);
+
+void usage(char* filename) {
+    printf("Usage: %s (%s) (%s) (%s) [%s]\n"
+           "Aborting...\n",
+            filename,
+            "work_dir",
+            "data_MB_per_dataset",
+            "max_key_size",
+            "cipher options");
+}
+
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//xorshift64* - reproducible data across runs and machines
+unsigned long long rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+size_t rng_log_uniform(size_t lo, size_t hi) {
+    double r = (double)(rng_next() >> 11) / (double)(1ULL << 53);
+    double lg = log((double)lo) +
+                r * (log((double)hi) - log((double)lo));
+    return (size_t)exp(lg);
+}
+
+int write_random_file(const char *path, size_t size) {
+    static unsigned long long buf[GEN_BUF_SIZE / sizeof(unsigned long long)];
+    size_t i, n;
+    ssize_t w;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd < 0) {
+        printf("ERROR: Failed to create file [%s]\n"
+               "Cause: %s [%d]\n",
+               path, strerror(errno), errno);
+        return 1;
+    }
+    while (size) {
+        n = size < sizeof(buf) ? size : sizeof(buf);
+        for (i = 0; i < (n + 7) / 8; i++)
+            buf[i] = rng_next();
+        w = write(fd, buf, n);
+        if (w <= 0) {
+            printf("ERROR: Failed to write file [%s]\n"
+                   "Cause: %s [%d]\n",
+                   path, strerror(errno), errno);
+            close(fd);
+            return 1;
+        }
+        size -= (size_t)w;
+    }
+    return close(fd) != 0;
+}
+
+/* fills work_dir/<name> with about budget bytes, shaped by the dataset name */
+int make_dataset(const char *work_dir, struct dataset *ds, size_t budget) {
+    char path[PATH_MAX];
+    size_t size;
+
+    snprintf(path, sizeof(path), "%s/%s", work_dir, ds->name);
+    if (mkdir(path, 0777) && errno != EEXIST) {
+        printf("ERROR: Failed to create directory [%s]\n"
+               "Cause: %s [%d]\n",
+               path, strerror(errno), errno);
+        return 1;
+    }
+    ds->files = ds->bytes = 0;
+    while (ds->bytes < budget) {
+        if (!strcmp(ds->name, "tiny"))
+            size = TINY_MIN + rng_next() % (TINY_MAX - TINY_MIN + 1);
+        else if (!strcmp(ds->name, "huge"))
+            size = budget / HUGE_FILES;
+        else
+            size = rng_log_uniform(MIXED_MIN, MIXED_MAX);
+        if (size > budget - ds->bytes)
+            size = budget - ds->bytes;
+        snprintf(path, sizeof(path), "%s/%s/f%06zu", work_dir, ds->name, ds->files);
+        if (write_random_file(path, size))
+            return 1;
+        ds->files++;
+        ds->bytes += size;
+    }
+    return 0;
+}
+
+int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+int remove_tree(const char *path) {
+    if (access(path, F_OK))
+        return 0;
+    return nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* syscr/syscw of this process, including every child reaped so far */
+int read_io_counters(struct io_counters *c) {
+    char line[128];
+    FILE *f = fopen("/proc/self/io", "r");
+
+    if (!f)
+        return 1;
+    memset(c, 0, sizeof(*c));
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "syscr: %llu", &c->syscr);
+        sscanf(line, "syscw: %llu", &c->syscw);
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ * evicts the sources and the key from the page cache. Per-file fadvise
+ * works unprivileged; drop_caches additionally clears dentries and inodes
+ * when we happen to run as root.
+ */
+int drop_caches(const char *src_dir, const char *key_path) {
+    char path[PATH_MAX];
+    struct dirent *de;
+    DIR *d;
+    int fd;
+
+    sync();
+    fd = open(key_path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    d = opendir(src_dir);
+    if (!d)
+        return 1;
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", src_dir, de->d_name);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    closedir(d);
+
+    fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd >= 0) {
+        if (write(fd, "3", 1) != 1) {
+            //not fatal - fadvise already covered the data we care about
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+int run_cipher(char *const argv[], struct result *res) {
+    struct io_counters before, after;
+    struct rusage ru;
+    int status, devnull;
+    double t1;
+    pid_t pid;
+
+    if (read_io_counters(&before)) {
+        printf("ERROR: Failed to read /proc/self/io\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        return 1;
+    }
+    t1 = now_sec();
+    pid = fork();
+    if (pid < 0) {
+        printf("ERROR: Failed to fork\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        return 1;
+    }
+    if (pid == 0) {
+        devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0)
+            dup2(devnull, STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        printf("ERROR: Failed to wait for cipher\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        return 1;
+    }
+    res->seconds = now_sec() - t1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        printf("ERROR: cipher failed [status %d]\n", status);
+        return 1;
+    }
+    res->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    res->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    if (read_io_counters(&after))
+        return 1;
+    //our own read of /proc/self/io is one syscr
+    res->syscalls = (after.syscr - before.syscr - 1) + (after.syscw - before.syscw);
+    return 0;
+}
+
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+int read_latencies(const char *path, struct result *res) {
+    long long *lat = NULL, *tmp, v;
+    size_t n = 0, cap = 0;
+    FILE *f = fopen(path, "r");
+
+    res->p50 = res->p99 = -1;
+    if (!f)
+        return 1;
+    while (fscanf(f, "%lld", &v) == 1) {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            tmp = (long long *) realloc (lat, cap * sizeof(long long));
+            if (!tmp) {
+                free(lat);
+                fclose(f);
+                return 1;
+            }
+            lat = tmp;
+        }
+        lat[n++] = v;
+    }
+    fclose(f);
+    if (n) {
+        qsort(lat, n, sizeof(long long), cmp_ll);
+        res->p50 = lat[(n - 1) * 50 / 100];
+        res->p99 = lat[(n - 1) * 99 / 100];
+    }
+    free(lat);
+    return 0;
+}
+
+int main ( int argc, char *argv[]) {
+
+    if (argc < 4 || argc - 4 > MAX_ARGS - 16) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    const char *work_dir = argv[1];
+    size_t budget = (size_t)strtoul(argv[2], NULL, 10) * MB;
+    size_t max_key = (size_t)strtoull(argv[3], NULL, 10);
+    struct dataset datasets[] = { { "tiny" }, { "huge" }, { "mixed" } };
+    char cipher[PATH_MAX], exe[PATH_MAX];
+    char key_path[PATH_MAX], src_dir[PATH_MAX], tgt_dir[PATH_MAX], lat_path[PATH_MAX];
+    char buf_arg[32];
+    char *args[MAX_ARGS];
+    struct result res;
+    size_t d, k, b;
+    int a, cold, i, rc = 0;
+    ssize_t len;
+
+    if (!budget || !max_key) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    //cipher is expected next to us
+    len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len < 0) {
+        printf("ERROR: Failed to locate executable\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        return -1;
+    }
+    exe[len] = '\0';
+    snprintf(cipher, sizeof(cipher), "%s/cipher", dirname(exe));
+
+    if (mkdir(work_dir, 0777) && errno != EEXIST) {
+        printf("ERROR: Failed to create directory [%s]\n"
+               "Cause: %s [%d]\n",
+               work_dir, strerror(errno), errno);
+        return -1;
+    }
+    for (d = 0; d < sizeof(datasets) / sizeof(datasets[0]); d++) {
+        if (make_dataset(work_dir, &datasets[d], budget))
+            return -1;
+    }
+    snprintf(key_path, sizeof(key_path), "%s/key", work_dir);
+    snprintf(tgt_dir, sizeof(tgt_dir), "%s/out", work_dir);
+    snprintf(lat_path, sizeof(lat_path), "%s/latency", work_dir);
+
+    //cipher [options] -b N --latency-log FILE src key tgt
+    i = 0;
+    args[i++] = cipher;
+    for (a = 4; a < argc; a++)
+        args[i++] = argv[a];
+    args[i++] = "-b";
+    args[i++] = buf_arg;
+    args[i++] = "--latency-log";
+    args[i++] = lat_path;
+    args[i++] = src_dir;
+    args[i++] = key_path;
+    args[i++] = tgt_dir;
+    args[i] = NULL;
+
+    printf("dataset,files,bytes,key_size,buf_size,cache,seconds,MBps,files_per_s,"
+           "syscalls_per_MB,user_s,sys_s,p50_us,p99_us\n");
+    for (k = 0; k < sizeof(key_sizes) / sizeof(key_sizes[0]); k++) {
+        if (key_sizes[k] > max_key)
+            break;
+        if (write_random_file(key_path, key_sizes[k])) {
+            rc = -1;
+            goto cleanup;
+        }
+        for (d = 0; d < sizeof(datasets) / sizeof(datasets[0]); d++) {
+            snprintf(src_dir, sizeof(src_dir), "%s/%s", work_dir, datasets[d].name);
+            for (b = 0; b < sizeof(buf_sizes) / sizeof(buf_sizes[0]); b++) {
+                snprintf(buf_arg, sizeof(buf_arg), "%zu", buf_sizes[b]);
+                //the cold run leaves the sources cached for the warm one
+                for (cold = 1; cold >= 0; cold--) {
+                    remove_tree(tgt_dir);
+                    if (cold)
+                        drop_caches(src_dir, key_path);
+                    if (run_cipher(args, &res)) {
+                        rc = -1;
+                        goto cleanup;
+                    }
+                    read_latencies(lat_path, &res);
+                    printf("%s,%zu,%zu,%zu,%zu,%s,%.4f,%.1f,%.1f,%.2f,%.4f,%.4f,%lld,%lld\n",
+                           datasets[d].name, datasets[d].files, datasets[d].bytes,
+                           key_sizes[k], buf_sizes[b], cold ? "cold" : "warm",
+                           res.seconds,
+                           datasets[d].bytes / (double)MB / res.seconds,
+                           datasets[d].files / res.seconds,
+                           res.syscalls / (datasets[d].bytes / (double)MB),
+                           res.user, res.sys, res.p50, res.p99);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+cleanup:
+    remove_tree(tgt_dir);
+    unlink(lat_path);
+    return rc;
+}
@@ -0,0 +1,265 @@
+/*
+ * cipherfs: read-only FUSE view of a directory encrypted by cipher, that
+ * decrypts on read. every target starts at key offset 0, so the key byte
+ * for file offset off is key[off % key size] - any read, at any offset,
+ * is a pread and one XOR against a contiguous slice of the key tile.
+ *
+ *   cipherfs <encrypted dir> <key> <mountpoint> [FUSE options]
+ */
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION 31
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/statvfs.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<dirent.h>
+#include<fuse.h>
+#include "xor_kernel.h"
+#include "manifest.h"
+
+#define CFS_MAX_READ    (1024 * 1024)  //largest read the kernel sends us
+#define CFS_TIMEOUT     60.0           //seconds the kernel may cache names and attributes
+#define MIN(x, y)       (((x) < (y)) ? (x) : (y))
+
+/* shared read-only by every FUSE thread once mounted */
+struct cfs {
+    int    root_fd;             //the encrypted dir
+    char   *tile;               //the key repeated - key_size + CFS_MAX_READ bytes
+    size_t key_size;
+};
+
+static struct cfs cfs;
+
+static const char *rel_path(const char *path);
+static int is_hidden(const char *path);
+static int load_tile(const char *key_path);
+static void *cfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg);
+static int cfs_getattr(const char *path, struct stat *st, struct fuse_file_info *fi);
+static int cfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off,
+                       struct fuse_file_info *fi, enum fuse_readdir_flags flags);
+static int cfs_open(const char *path, struct fuse_file_info *fi);
+static int cfs_read(const char *path, char *buf, size_t size, off_t off,
+                    struct fuse_file_info *fi);
+static int cfs_release(const char *path, struct fuse_file_info *fi);
+static int cfs_statfs(const char *path, struct statvfs *st);
+
+/* FUSE paths start at the mount root - make them relative to root_fd */
+static const char *rel_path(const char *path) {
+    while (*path == '/')
+        path++;
+    return *path ? path : ".";
+}
+
+/* the manifest is cipher's bookkeeping, not an encrypted file */
+static int is_hidden(const char *path) {
+    return !strcmp(rel_path(path), MANIFEST_NAME);
+}
+
+/* the tile is built once and shared - a read never needs to wrap around
+ * the end of the key, whatever its offset */
+static int load_tile(const char *key_path) {
+    struct stat st;
+    size_t i, done = 0;
+    ssize_t n;
+    int fd;
+
+    fd = open(key_path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+        printf("ERROR: Failed to open key file [%s]\n"
+               "Cause: %s [%d]\n",
+               key_path, strerror(errno), errno);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    cfs.key_size = (size_t)st.st_size;
+    cfs.tile = (char *) malloc (cfs.key_size + CFS_MAX_READ);
+    if (!cfs.tile) {
+        printf("ERROR: Failed to allocate key tile\n");
+        close(fd);
+        return 1;
+    }
+    while (done < cfs.key_size) {
+        n = read(fd, cfs.tile + done, cfs.key_size - done);
+        if (n <= 0) {
+            printf("ERROR: Failed to read key file [%s]\n"
+                   "Cause: %s [%d]\n",
+                   key_path, strerror(errno), errno);
+            close(fd);
+            return 1;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+    for (i = cfs.key_size; i < cfs.key_size + CFS_MAX_READ; i++)
+        cfs.tile[i] = cfs.tile[i - cfs.key_size];
+    return 0;
+}
+
+static void *cfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+    //whole large reads per request, and read ahead as far
+    conn->max_read = CFS_MAX_READ;
+    conn->max_readahead = CFS_MAX_READ;
+
+    //the page cache holds plaintext - keep it across opens. a target
+    //re-encrypted underneath shows up once the timeouts run out
+    cfg->kernel_cache = 1;
+    cfg->entry_timeout = CFS_TIMEOUT;
+    cfg->attr_timeout = CFS_TIMEOUT;
+    cfg->negative_timeout = CFS_TIMEOUT;
+    cfg->use_ino = 1;
+    return NULL;
+}
+
+static int cfs_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
+    int rc;
+
+    if (fi)
+        rc = fstat((int)fi->fh, st);
+    else if (is_hidden(path))
+        return -ENOENT;
+    else
+        rc = fstatat(cfs.root_fd, rel_path(path), st, AT_SYMLINK_NOFOLLOW);
+    if (rc)
+        return -errno;
+    //read-only view
+    st->st_mode &= ~(mode_t)(S_IWUSR | S_IWGRP | S_IWOTH);
+    return 0;
+}
+
+static int cfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off,
+                       struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+    struct dirent *ent;
+    DIR *dir;
+    int fd;
+
+    (void)off;
+    (void)fi;
+    (void)flags;
+    fd = openat(cfs.root_fd, rel_path(path), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -errno;
+    dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return -errno;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (!strcmp(rel_path(path), ".") && !strcmp(ent->d_name, MANIFEST_NAME))
+            continue;
+        if (filler(buf, ent->d_name, NULL, 0, 0))
+            break;
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int cfs_open(const char *path, struct fuse_file_info *fi) {
+    int fd;
+
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        return -EROFS;
+    if (is_hidden(path))
+        return -ENOENT;
+    fd = openat(cfs.root_fd, rel_path(path), O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    fi->fh = (uint64_t)fd;
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static int cfs_read(const char *path, char *buf, size_t size, off_t off,
+                    struct fuse_file_info *fi) {
+    size_t done = 0, n;
+    ssize_t b;
+
+    (void)path;
+    //a short read means end of file to the kernel - fill the whole request
+    while (done < size) {
+        b = pread((int)fi->fh, buf + done, size - done, off + (off_t)done);
+        if (b < 0 && errno == EINTR)
+            continue;
+        if (b < 0)
+            return -errno;
+        if (!b)
+            break;
+        done += (size_t)b;
+    }
+
+    //max_read keeps requests within the tile, but don't rely on it
+    for (n = 0; n < done; n += MIN(done - n, CFS_MAX_READ))
+        xor_buf(buf + n, buf + n,
+                cfs.tile + (size_t)(((uint64_t)off + n) % cfs.key_size),
+                MIN(done - n, CFS_MAX_READ));
+    return (int)done;
+}
+
+static int cfs_release(const char *path, struct fuse_file_info *fi) {
+    (void)path;
+    close((int)fi->fh);
+    return 0;
+}
+
+static int cfs_statfs(const char *path, struct statvfs *st) {
+    (void)path;
+    return fstatvfs(cfs.root_fd, st) ? -errno : 0;
+}
+
+static const struct fuse_operations cfs_ops = {
+    .init       = cfs_init,
+    .getattr    = cfs_getattr,
+    .readdir    = cfs_readdir,
+    .open       = cfs_open,
+    .read       = cfs_read,
+    .release    = cfs_release,
+    .statfs     = cfs_statfs,
+};
+
+int main(int argc, char *argv[]) {
+    struct fuse_args args;
+    char max_read[64];
+    int rc;
+
+    if (argc < 4) {
+        printf("Usage: %s <encrypted dir> <key> <mountpoint> [FUSE options]\n"
+               "Mounts a read-only, decrypted view of a dir encrypted by cipher.\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    //opened before FUSE daemonizes (and changes to /)
+    cfs.root_fd = open(argv[1], O_RDONLY | O_DIRECTORY);
+    if (cfs.root_fd < 0) {
+        printf("ERROR: Failed to open dir [%s]\n"
+               "Cause: %s [%d]\n",
+               argv[1], strerror(errno), errno);
+        return EXIT_FAILURE;
+    }
+    if (load_tile(argv[2])) {
+        close(cfs.root_fd);
+        return EXIT_FAILURE;
+    }
+    xor_init();
+
+    //FUSE sees: program name, mountpoint, options
+    argv[2] = argv[0];
+    args = (struct fuse_args)FUSE_ARGS_INIT(argc - 2, argv + 2);
+    snprintf(max_read, sizeof(max_read), "-omax_read=%d", CFS_MAX_READ);
+    if (fuse_opt_add_arg(&args, "-oro") || fuse_opt_add_arg(&args, max_read)) {
+        printf("ERROR: Failed to build mount options\n");
+        rc = EXIT_FAILURE;
+    } else {
+        rc = fuse_main(args.argc, args.argv, &cfs_ops, NULL);
+    }
+
+    fuse_opt_free_args(&args);
+    free(cfs.tile);
+    close(cfs.root_fd);
+    return rc;
+}
@@ -0,0 +1,195 @@
+#include<stdint.h>
+#include<string.h>
+#include "crc32c.h"
+#include "xor_kernel.h"
+
+#if defined(__x86_64__)
+#include<immintrin.h>
+#define CRC_X86 1
+#endif
+
+#define POLY            0x82f63b78      //Castagnoli, bit-reversed
+#define SW_BLOCK        4096            //fallback: bytes per CRC/XOR/CRC round
+#define HW_LANE         512             //bytes per interleaved crc32 chain
+#define HW_BLOCK        (6 * HW_LANE)   //bytes per CRC/XOR/CRC round - two rounds of lanes
+
+static uint32_t table[8][256];          //slicing-by-8
+static uint32_t lane_shift[4][256];     //appends HW_LANE zero bytes to a CRC, by byte
+static int use_hw;
+
+static void build_table(void);
+static void build_lane_shift(void);
+static uint32_t shift_lane(uint32_t crc);
+static uint32_t crc_sw(uint32_t crc, const unsigned char *p, size_t len);
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec);
+static void gf2_square(uint32_t *square, const uint32_t *mat);
+
+static void build_table(void) {
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        c = (uint32_t)i;
+        for (j = 0; j < 8; j++)
+            c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+        table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+}
+
+/*Software fallback - eight bytes per table round (crc is pre-inverted)*/
+static uint32_t crc_sw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t w;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&w, p, sizeof(w));
+        w ^= crc;
+        crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+              table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+              table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+              table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+    }
+    for (; len; len--, p++)
+        crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xff];
+    return crc;
+}
+
+#ifdef CRC_X86
+
+/*crc32 has a 3 cycle latency but issues every cycle - three independent
+ *lanes keep it busy. the lanes after the first start from 0 and are
+ *merged in by shifting the running CRC over them (crc is pre-inverted)*/
+__attribute__((target("sse4.2")))
+static uint32_t crc_hw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc, c1, c2, w;
+    size_t i;
+
+    for (; len >= 3 * HW_LANE; len -= 3 * HW_LANE, p += 3 * HW_LANE) {
+        c1 = c2 = 0;
+        for (i = 0; i < HW_LANE; i += 8) {
+            memcpy(&w, p + i, sizeof(w));
+            c = _mm_crc32_u64(c, w);
+            memcpy(&w, p + HW_LANE + i, sizeof(w));
+            c1 = _mm_crc32_u64(c1, w);
+            memcpy(&w, p + 2 * HW_LANE + i, sizeof(w));
+            c2 = _mm_crc32_u64(c2, w);
+        }
+        c = shift_lane((uint32_t)c) ^ c1;
+        c = shift_lane((uint32_t)c) ^ c2;
+    }
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&w, p, sizeof(w));
+        c = _mm_crc32_u64(c, w);
+    }
+    for (; len; len--, p++)
+        c = _mm_crc32_u8((uint32_t)c, *p);
+    return (uint32_t)c;
+}
+
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+#ifdef CRC_X86
+    if (use_hw)
+        return ~crc_hw(~crc, (const unsigned char *)buf, len);
+#endif
+    return ~crc_sw(~crc, (const unsigned char *)buf, len);
+}
+
+void xor_crc32c(char *dst, const char *src, const char *key, size_t len,
+                uint32_t *plain, uint32_t *cipher) {
+    size_t i, n, block = use_hw ? HW_BLOCK : SW_BLOCK;
+
+    //a cache-sized block at a time, so the data is read from memory once.
+    //the XOR is left to the dispatched kernel, the CRCs read it from L1
+    for (i = 0; i < len; i += n) {
+        n = len - i < block ? len - i : block;
+        *plain = crc32c(*plain, src + i, n);       //before dst may overwrite it
+        xor_buf(dst + i, src + i, key + i, n);
+        *cipher = crc32c(*cipher, dst + i, n);
+    }
+}
+
+/* combine: multiply by x^(8*len2) in GF(2), by repeated squaring of the
+ * one-zero-bit operator (after zlib's crc32_combine) */
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1)
+            sum ^= *mat;
+    return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *mat) {
+    int n;
+
+    for (n = 0; n < 32; n++)
+        square[n] = gf2_times(mat, mat[n]);
+}
+
+static void build_lane_shift(void) {
+    uint32_t op[32], square[32], row = 1;
+    size_t bits;
+    int n, i;
+
+    //one zero bit, squared up to 8 * HW_LANE of them (a power of two)
+    op[0] = POLY;
+    for (n = 1; n < 32; n++, row <<= 1)
+        op[n] = row;
+    for (bits = 1; bits < 8 * HW_LANE; bits <<= 1) {
+        gf2_square(square, op);
+        memcpy(op, square, sizeof(square));
+    }
+    //the operator is linear - tabulate it a byte of the CRC at a time
+    for (n = 0; n < 4; n++)
+        for (i = 0; i < 256; i++)
+            lane_shift[n][i] = gf2_times(op, (uint32_t)i << (8 * n));
+}
+
+static uint32_t shift_lane(uint32_t crc) {
+    return lane_shift[0][crc & 0xff] ^ lane_shift[1][(crc >> 8) & 0xff] ^
+           lane_shift[2][(crc >> 16) & 0xff] ^ lane_shift[3][crc >> 24];
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    uint32_t even[32], odd[32], row = 1;
+    int n;
+
+    if (!len2)
+        return crc1;
+    odd[0] = POLY;
+    for (n = 1; n < 32; n++, row <<= 1)
+        odd[n] = row;
+    gf2_square(even, odd);          //2 zero bits
+    gf2_square(odd, even);          //4 zero bits
+
+    //the first squaring below makes it one zero byte
+    do {
+        gf2_square(even, odd);
+        if (len2 & 1)
+            crc1 = gf2_times(even, crc1);
+        len2 >>= 1;
+        if (!len2)
+            break;
+        gf2_square(odd, even);
+        if (len2 & 1)
+            crc1 = gf2_times(odd, crc1);
+        len2 >>= 1;
+    } while (len2);
+    return crc1 ^ crc2;
+}
+
+const char *crc32c_init(void) {
+    build_table();
+    build_lane_shift();
+#ifdef CRC_X86
+    __builtin_cpu_init();
+    use_hw = __builtin_cpu_supports("sse4.2");
+    if (use_hw)
+        return "sse4.2";
+#endif
+    return "table";
+}
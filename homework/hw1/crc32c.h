@@ -0,0 +1,23 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include<stddef.h>
+#include<stdint.h>
+
+/* CRC32C (Castagnoli), zlib-style: pass 0 to start, and the previous
+ * result to continue over the next buffer. */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* dst[i] = src[i] ^ key[i] through xor_buf(), while folding src into
+ * *plain and dst into *cipher - a cache-sized block at a time, so the
+ * data is read from memory once for all three. dst may alias src. */
+void xor_crc32c(char *dst, const char *src, const char *key, size_t len,
+                uint32_t *plain, uint32_t *cipher);
+
+/* the CRC of A followed by B, given crc(A), crc(B) and B's length */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/* picks the SSE4.2 instructions when the CPU has them. returns their name */
+const char *crc32c_init(void);
+
+#endif
@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "manifest.h"
+
+#define MANIFEST_MAGIC  "cipher-manifest"
+#define MANIFEST_VER    3              //2: CRC32C columns, 3: key mode
+#define MANIFEST_TMP    MANIFEST_NAME ".tmp"
+#define INIT_CAP        1024
+
+static uint64_t path_hash(const char *path);
+static struct manifest_entry *lookup(struct manifest *m, const char *path, uint64_t hash);
+static int grow(struct manifest *m);
+static struct manifest_entry *insert(struct manifest *m, const char *path);
+static void remove_slot(struct manifest *m, struct manifest_entry *e);
+static void put_path(FILE *f, const char *path);
+static char *get_path(char *str);
+
+/*FNV-1a*/
+static uint64_t path_hash(const char *path) {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *path; path++) {
+        h ^= (unsigned char)*path;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct manifest_entry *lookup(struct manifest *m, const char *path, uint64_t hash) {
+    size_t i = (size_t)hash & (m->cap - 1);
+
+    for (; m->slots[i].path; i = (i + 1) & (m->cap - 1)) {
+        if (m->slots[i].hash == hash && !strcmp(m->slots[i].path, path))
+            return &m->slots[i];
+    }
+    return &m->slots[i];    //the empty slot where path would go
+}
+
+static int grow(struct manifest *m) {
+    struct manifest_entry *old = m->slots;
+    size_t old_cap = m->cap, i;
+
+    m->slots = (struct manifest_entry *) calloc (old_cap * 2, sizeof(struct manifest_entry));
+    if (!m->slots) {
+        m->slots = old;
+        return 1;
+    }
+    m->cap = old_cap * 2;
+    for (i = 0; i < old_cap; i++) {
+        if (old[i].path)
+            *lookup(m, old[i].path, old[i].hash) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static struct manifest_entry *insert(struct manifest *m, const char *path) {
+    uint64_t hash = path_hash(path);
+    struct manifest_entry *e = lookup(m, path, hash);
+
+    if (e->path)
+        return e;
+    //keep the table at most half full
+    if (2 * (m->count + 1) > m->cap) {
+        if (grow(m))
+            return NULL;
+        e = lookup(m, path, hash);
+    }
+    e->path = strdup(path);
+    if (!e->path)
+        return NULL;
+    e->hash = hash;
+    m->count++;
+    return e;
+}
+
+/* deletes an entry, re-placing the rest of its probe run */
+static void remove_slot(struct manifest *m, struct manifest_entry *e) {
+    size_t i = (size_t)(e - m->slots);
+    struct manifest_entry moved;
+
+    free(e->path);
+    e->path = NULL;
+    m->count--;
+    for (i = (i + 1) & (m->cap - 1); m->slots[i].path; i = (i + 1) & (m->cap - 1)) {
+        moved = m->slots[i];
+        m->slots[i].path = NULL;
+        *lookup(m, moved.path, moved.hash) = moved;
+    }
+}
+
+/* paths are one per line - escape the characters that would break that */
+static void put_path(FILE *f, const char *path) {
+    for (; *path; path++) {
+        if (*path == '\\')
+            fputs("\\\\", f);
+        else if (*path == '\n')
+            fputs("\\n", f);
+        else
+            fputc(*path, f);
+    }
+    fputc('\n', f);
+}
+
+static char *get_path(char *str) {
+    char *r = str, *w = str;
+
+    for (; *r && *r != '\n'; r++) {
+        if (*r == '\\' && r[1]) {
+            r++;
+            *w++ = *r == 'n' ? '\n' : *r;
+        } else {
+            *w++ = *r;
+        }
+    }
+    *w = '\0';
+    return str;
+}
+
+struct manifest *manifest_load(int tgt_fd, const struct stat *key_stats, int key_mode) {
+    struct manifest *m;
+    struct manifest_entry *e;
+    FILE *f;
+    char *line = NULL;
+    size_t line_cap = 0;
+    unsigned long long ino, size;
+    long long sec, nsec;
+    unsigned plain_crc, cipher_crc;
+    int ver, mode, fd, n;
+
+    m = (struct manifest *) calloc (1, sizeof(struct manifest));
+    if (!m)
+        return NULL;
+    m->cap = INIT_CAP;
+    m->slots = (struct manifest_entry *) calloc (m->cap, sizeof(struct manifest_entry));
+    if (!m->slots || pthread_mutex_init(&m->lock, NULL)) {
+        free(m->slots);
+        free(m);
+        return NULL;
+    }
+    if (key_stats) {
+        m->key_ino = key_stats->st_ino;
+        m->key_size = key_stats->st_size;
+        m->key_mtime = key_stats->st_mtim;
+        m->key_mode = key_mode;
+    }
+
+    fd = openat(tgt_fd, MANIFEST_NAME, O_RDONLY);
+    if (fd < 0)
+        return m;           //first run
+    f = fdopen(fd, "r");
+    if (!f) {
+        close(fd);
+        return m;
+    }
+
+    //targets encrypted with another key (or keystream) must all be redone
+    if (getline(&line, &line_cap, f) <= 0 ||
+        sscanf(line, MANIFEST_MAGIC " %d %d %llu %llu %lld.%lld",
+               &ver, &mode, &ino, &size, &sec, &nsec) != 6 ||
+        ver != MANIFEST_VER)
+        goto out;
+    if (!key_stats) {
+        m->key_ino = (ino_t)ino;
+        m->key_size = (off_t)size;
+        m->key_mtime.tv_sec = sec;
+        m->key_mtime.tv_nsec = nsec;
+        m->key_mode = mode;
+    } else if ((ino_t)ino != m->key_ino || (off_t)size != m->key_size ||
+               sec != m->key_mtime.tv_sec || nsec != m->key_mtime.tv_nsec ||
+               mode != m->key_mode) {
+        goto out;
+    }
+
+    while (getline(&line, &line_cap, f) > 0) {
+        if (sscanf(line, "%llu %llu %lld.%lld %x %x %n", &ino, &size, &sec, &nsec,
+                   &plain_crc, &cipher_crc, &n) != 6)
+            continue;
+        e = insert(m, get_path(line + n));
+        if (!e) {
+            manifest_free(m);
+            m = NULL;
+            goto out;
+        }
+        e->ino = (ino_t)ino;
+        e->size = (off_t)size;
+        e->mtime.tv_sec = sec;
+        e->mtime.tv_nsec = nsec;
+        e->plain_crc = plain_crc;
+        e->cipher_crc = cipher_crc;
+    }
+
+out:
+    free(line);
+    fclose(f);
+    return m;
+}
+
+int manifest_unchanged(struct manifest *m, const char *path, const struct stat *st) {
+    struct manifest_entry *e;
+    int unchanged = 0;
+
+    pthread_mutex_lock(&m->lock);
+    /**CS**/
+    e = lookup(m, path, path_hash(path));
+    if (e->path) {
+        e->seen = 1;
+        unchanged = e->ino == st->st_ino && e->size == st->st_size &&
+                    e->mtime.tv_sec == st->st_mtim.tv_sec &&
+                    e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+    }
+    /**CS-END**/
+    pthread_mutex_unlock(&m->lock);
+    return unchanged;
+}
+
+int manifest_update(struct manifest *m, const char *path, const struct stat *st,
+                    uint32_t plain_crc, uint32_t cipher_crc) {
+    struct manifest_entry *e;
+    int rc = 0;
+
+    pthread_mutex_lock(&m->lock);
+    /**CS**/
+    e = insert(m, path);
+    if (e) {
+        e->ino = st->st_ino;
+        e->size = st->st_size;
+        e->mtime = st->st_mtim;
+        e->plain_crc = plain_crc;
+        e->cipher_crc = cipher_crc;
+        e->seen = 1;
+    } else {
+        rc = 1;
+    }
+    /**CS-END**/
+    pthread_mutex_unlock(&m->lock);
+    return rc;
+}
+
+void manifest_drop(struct manifest *m, const char *path) {
+    struct manifest_entry *e;
+
+    pthread_mutex_lock(&m->lock);
+    /**CS**/
+    e = lookup(m, path, path_hash(path));
+    if (e->path)
+        remove_slot(m, e);
+    /**CS-END**/
+    pthread_mutex_unlock(&m->lock);
+}
+
+int manifest_prune(struct manifest *m, int tgt_fd, const char *tgt_path, int recursive) {
+    size_t i = 0;
+    int rc = 0;
+
+    while (i < m->cap) {
+        if (!m->slots[i].path || m->slots[i].seen ||
+            (!recursive && strchr(m->slots[i].path, '/'))) {
+            i++;
+            continue;
+        }
+        //the source is gone - so is its target
+        if (unlinkat(tgt_fd, m->slots[i].path, 0) && errno != ENOENT) {
+            printf("ERROR: Failed to remove file [%s/%s]\n"
+                   "Cause: %s [%d]\n",
+                   tgt_path, m->slots[i].path, strerror(errno), errno);
+            rc = 1;
+            i++;
+            continue;
+        }
+        //removal may pull a later entry into slot i - look at it again
+        remove_slot(m, &m->slots[i]);
+    }
+    return rc;
+}
+
+int manifest_save(struct manifest *m, int tgt_fd, const char *tgt_path) {
+    FILE *f;
+    size_t i;
+    int fd, rc;
+
+    fd = openat(tgt_fd, MANIFEST_TMP, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !(f = fdopen(fd, "w"))) {
+        printf("ERROR: Failed to write manifest [%s/%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, MANIFEST_TMP, strerror(errno), errno);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    fprintf(f, MANIFEST_MAGIC " %d %d %llu %llu %lld.%09ld\n", MANIFEST_VER,
+            m->key_mode, (unsigned long long)m->key_ino, (unsigned long long)m->key_size,
+            (long long)m->key_mtime.tv_sec, m->key_mtime.tv_nsec);
+    for (i = 0; i < m->cap; i++) {
+        if (!m->slots[i].path)
+            continue;
+        fprintf(f, "%llu %llu %lld.%09ld %08x %08x ",
+                (unsigned long long)m->slots[i].ino,
+                (unsigned long long)m->slots[i].size,
+                (long long)m->slots[i].mtime.tv_sec, m->slots[i].mtime.tv_nsec,
+                m->slots[i].plain_crc, m->slots[i].cipher_crc);
+        put_path(f, m->slots[i].path);
+    }
+
+    rc = ferror(f);
+    rc |= fclose(f);
+    //replace the old manifest only once the new one is complete
+    if (rc || renameat(tgt_fd, MANIFEST_TMP, tgt_fd, MANIFEST_NAME)) {
+        printf("ERROR: Failed to write manifest [%s/%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, MANIFEST_NAME, strerror(errno), errno);
+        unlinkat(tgt_fd, MANIFEST_TMP, 0);
+        return 1;
+    }
+    return 0;
+}
+
+void manifest_free(struct manifest *m) {
+    size_t i;
+
+    for (i = 0; i < m->cap; i++)
+        free(m->slots[i].path);
+    free(m->slots);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
@@ -0,0 +1,64 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<stdint.h>
+#include<pthread.h>
+
+#define MANIFEST_NAME   ".cipher_manifest"
+
+/* how the key file turned into key bytes */
+#define KEY_MODE_TILE   0               //the key file, repeated
+#define KEY_MODE_CHACHA 1               //--chacha: ChaCha20 seeded by the key file
+
+/* what a source file looked like when it was last encrypted */
+struct manifest_entry {
+    char            *path;      //relative to the source root
+    uint64_t        hash;
+    ino_t           ino;
+    off_t           size;
+    struct timespec mtime;
+    uint32_t        plain_crc;  //CRC32C of the source
+    uint32_t        cipher_crc; //CRC32C of the target
+    int             seen;       //the source was found by this run
+};
+
+/* source files encrypted into a target dir, keyed by relative path */
+struct manifest {
+    struct manifest_entry *slots;   //open addressing, path == NULL is empty
+    size_t          cap;            //power of two
+    size_t          count;
+    ino_t           key_ino;        //key the targets were encrypted with
+    off_t           key_size;
+    struct timespec key_mtime;
+    int             key_mode;       //KEY_MODE_*
+    pthread_mutex_t lock;
+};
+
+/*loads the manifest of a target dir. a missing one, or one written with
+ * another key or key mode, gives an empty manifest. a NULL key_stats
+ * accepts any key (and key_mode is ignored). returns NULL on failure*/
+struct manifest *manifest_load(int tgt_fd, const struct stat *key_stats, int key_mode);
+
+/*returns 1 (and marks the entry seen) if the source is unchanged since it
+ * was recorded. any recorded entry is marked seen, changed or not*/
+int manifest_unchanged(struct manifest *m, const char *path, const struct stat *st);
+
+/*records a freshly encrypted source, with the checksums of both sides*/
+int manifest_update(struct manifest *m, const char *path, const struct stat *st,
+                    uint32_t plain_crc, uint32_t cipher_crc);
+
+/*forgets a source whose target is no longer valid*/
+void manifest_drop(struct manifest *m, const char *path);
+
+/*unlinks the targets of sources that were not seen by this run. without
+ * recursive, sources in subdirectories weren't looked for and are kept*/
+int manifest_prune(struct manifest *m, int tgt_fd, const char *tgt_path, int recursive);
+
+/*writes the manifest to the target dir (atomically)*/
+int manifest_save(struct manifest *m, int tgt_fd, const char *tgt_path);
+
+void manifest_free(struct manifest *m);
+
+#endif
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include<sys/types.h>
+#include<unistd.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "pack.h"
+
+#define INIT_CAP        1024
+
+static uint32_t name_hash(const char *name, size_t len);
+static int pwrite_all(int fd, const void *buf, size_t len, uint64_t off);
+static int pread_all(int fd, void *buf, size_t len, uint64_t off);
+static int read_entry(struct pack_reader *r, uint64_t i, struct pack_entry *e);
+
+/*FNV-1a*/
+static uint32_t name_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, uint64_t off) {
+    const char *p = (const char *)buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        p += n;
+        off += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int pread_all(int fd, void *buf, size_t len, uint64_t off) {
+    char *p = (char *)buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = pread(fd, p, len, (off_t)off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (!n)             //archive shorter than its index says
+                errno = ENODATA;
+            return 1;
+        }
+        p += n;
+        off += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int pack_begin(struct pack_writer *w, int fd) {
+    char hdr[PACK_HDR_SIZE] = PACK_MAGIC;
+    uint32_t ver = PACK_VER;
+
+    memset(w, 0, sizeof(struct pack_writer));
+    w->fd = fd;
+    memcpy(hdr + 8, &ver, sizeof(ver));
+    if (pwrite_all(fd, hdr, sizeof(hdr), 0))
+        return 1;
+    w->end = PACK_HDR_SIZE;
+    return 0;
+}
+
+int pack_add(struct pack_writer *w, const char *name, uint64_t len, uint32_t crc) {
+    struct pack_entry *entries;
+    size_t name_len = strlen(name), cap;
+    char *names;
+
+    if (w->count == w->cap) {
+        cap = w->cap ? 2 * w->cap : INIT_CAP;
+        entries = (struct pack_entry *) realloc (w->entries, cap * sizeof(struct pack_entry));
+        if (!entries)
+            return 1;
+        w->entries = entries;
+        w->cap = cap;
+    }
+    if (w->names_len + name_len > w->names_cap) {
+        cap = w->names_cap ? 2 * w->names_cap : INIT_CAP * 16;
+        while (cap < w->names_len + name_len)
+            cap *= 2;
+        names = (char *) realloc (w->names, cap);
+        if (!names)
+            return 1;
+        w->names = names;
+        w->names_cap = cap;
+    }
+    //name offsets are 32-bit
+    if (w->names_len + name_len > UINT32_MAX) {
+        errno = EFBIG;
+        return 1;
+    }
+
+    memcpy(w->names + w->names_len, name, name_len);
+    w->entries[w->count].off = w->end;
+    w->entries[w->count].len = len;
+    w->entries[w->count].crc = crc;
+    w->entries[w->count].next = 0;
+    w->entries[w->count].name_off = (uint32_t)w->names_len;
+    w->entries[w->count].name_len = (uint32_t)name_len;
+    w->names_len += name_len;
+    w->count++;
+    w->end += len;
+    return 0;
+}
+
+int pack_finish(struct pack_writer *w) {
+    struct pack_footer foot;
+    struct pack_entry *e;
+    uint32_t *buckets;
+    uint64_t off = w->end;
+    size_t i, h;
+    int rc;
+
+    memset(&foot, 0, sizeof(foot));
+    memcpy(foot.magic, PACK_IDX_MAGIC, sizeof(foot.magic));
+    foot.version = PACK_VER;
+    foot.count = w->count;
+    for (foot.buckets = 1; foot.buckets < w->count; foot.buckets *= 2)
+        ;
+
+    //chain every entry into its bucket (the newest at the head)
+    buckets = (uint32_t *) calloc (foot.buckets, sizeof(uint32_t));
+    if (!buckets)
+        return 1;
+    for (i = 0; i < w->count; i++) {
+        e = &w->entries[i];
+        h = name_hash(w->names + e->name_off, e->name_len) & (foot.buckets - 1);
+        e->next = buckets[h];
+        buckets[h] = (uint32_t)i + 1;
+    }
+
+    foot.index_off = off;
+    rc = pwrite_all(w->fd, buckets, foot.buckets * sizeof(uint32_t), off);
+    off += foot.buckets * sizeof(uint32_t);
+    rc = rc || pwrite_all(w->fd, w->entries, w->count * sizeof(struct pack_entry), off);
+    off += w->count * sizeof(struct pack_entry);
+    foot.names_off = off;
+    rc = rc || pwrite_all(w->fd, w->names, w->names_len, off);
+    off += w->names_len;
+    rc = rc || pwrite_all(w->fd, &foot, sizeof(foot), off);
+    off += sizeof(foot);
+    rc = rc || ftruncate(w->fd, (off_t)off);
+    free(buckets);
+    return rc;
+}
+
+void pack_writer_free(struct pack_writer *w) {
+    free(w->entries);
+    free(w->names);
+    w->entries = NULL;
+    w->names = NULL;
+}
+
+int pack_open(struct pack_reader *r, int fd) {
+    char hdr[PACK_HDR_SIZE];
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    r->fd = fd;
+    if (size < (off_t)(PACK_HDR_SIZE + sizeof(struct pack_footer)) ||
+        pread_all(fd, hdr, sizeof(hdr), 0) ||
+        pread_all(fd, &r->foot, sizeof(r->foot), (uint64_t)size - sizeof(r->foot)))
+        return 1;
+    if (memcmp(hdr, PACK_MAGIC, 8) || memcmp(r->foot.magic, PACK_IDX_MAGIC, 8) ||
+        r->foot.version != PACK_VER || !r->foot.buckets ||
+        (r->foot.buckets & (r->foot.buckets - 1)) ||
+        r->foot.index_off + r->foot.buckets * sizeof(uint32_t) +
+        r->foot.count * sizeof(struct pack_entry) != r->foot.names_off ||
+        r->foot.names_off > (uint64_t)size - sizeof(r->foot)) {
+        errno = EINVAL;
+        return 1;
+    }
+    return 0;
+}
+
+static int read_entry(struct pack_reader *r, uint64_t i, struct pack_entry *e) {
+    return pread_all(r->fd, e, sizeof(struct pack_entry),
+                     r->foot.index_off + r->foot.buckets * sizeof(uint32_t) +
+                     i * sizeof(struct pack_entry));
+}
+
+int pack_member_at(struct pack_reader *r, uint64_t i, struct pack_member *m) {
+    struct pack_entry e;
+
+    if (i >= r->foot.count || read_entry(r, i, &e))
+        return 1;
+    if (e.name_len >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return 1;
+    }
+    if (pread_all(r->fd, m->name, e.name_len, r->foot.names_off + e.name_off))
+        return 1;
+    m->name[e.name_len] = '\0';
+    m->off = e.off;
+    m->len = e.len;
+    m->crc = e.crc;
+    return 0;
+}
+
+int pack_find(struct pack_reader *r, const char *name, struct pack_member *m) {
+    struct pack_entry e;
+    size_t len = strlen(name);
+    uint32_t idx;
+
+    if (pread_all(r->fd, &idx, sizeof(idx), r->foot.index_off +
+                  (name_hash(name, len) & (r->foot.buckets - 1)) * sizeof(uint32_t)))
+        return -1;
+    for (; idx; idx = e.next) {
+        if (idx > r->foot.count) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (read_entry(r, idx - 1, &e))
+            return -1;
+        if (e.name_len != len)
+            continue;
+        if (pack_member_at(r, idx - 1, m))
+            return -1;
+        if (!strcmp(m->name, name))
+            return 0;
+    }
+    return 1;
+}
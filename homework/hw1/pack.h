@@ -0,0 +1,90 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include<stddef.h>
+#include<stdint.h>
+#include<limits.h>
+
+/*
+ * --pack archive: every encrypted file appended to one container, and an
+ * index written after the last one.
+ *
+ *   header  "CIPHPACK", version                          16 bytes
+ *   payload of each file, back to back
+ *   buckets uint32 per bucket - first entry + 1 (0: empty)
+ *   entries struct pack_entry per file, in archive order
+ *   names   the entry names, not terminated
+ *   footer  struct pack_footer                           40 bytes
+ *
+ * integers are in host byte order. a name is found with a few preads of
+ * its bucket chain, however many files the archive holds.
+ */
+#define PACK_MAGIC      "CIPHPACK"
+#define PACK_IDX_MAGIC  "CIPHPIDX"
+#define PACK_VER        1
+#define PACK_HDR_SIZE   16
+
+struct pack_entry {
+    uint64_t off;               //payload offset in the archive
+    uint64_t len;
+    uint32_t crc;               //CRC32C of the payload (as stored)
+    uint32_t next;              //next entry of the bucket + 1 (0: end)
+    uint32_t name_off;          //into the names region
+    uint32_t name_len;
+};
+
+struct pack_footer {
+    char     magic[8];
+    uint32_t version;
+    uint32_t buckets;           //power of two
+    uint64_t count;
+    uint64_t index_off;         //start of the buckets
+    uint64_t names_off;
+};
+
+/* builds an archive - payloads are written by the caller, at end */
+struct pack_writer {
+    int      fd;
+    uint64_t end;               //where the next payload goes
+    struct pack_entry *entries;
+    size_t   count;
+    size_t   cap;
+    char     *names;
+    size_t   names_len;
+    size_t   names_cap;
+};
+
+/* one file of an archive */
+struct pack_member {
+    uint64_t off;
+    uint64_t len;
+    uint32_t crc;
+    char     name[PATH_MAX];
+};
+
+struct pack_reader {
+    int      fd;
+    struct pack_footer foot;
+};
+
+/*writes the header to an empty file. returns 1 on failure*/
+int pack_begin(struct pack_writer *w, int fd);
+
+/*records the len bytes the caller appended at w->end, and moves end past them*/
+int pack_add(struct pack_writer *w, const char *name, uint64_t len, uint32_t crc);
+
+/*writes the index and the footer after the last payload*/
+int pack_finish(struct pack_writer *w);
+
+void pack_writer_free(struct pack_writer *w);
+
+/*reads the footer. returns 1 if fd isn't a (complete) archive*/
+int pack_open(struct pack_reader *r, int fd);
+
+/*returns 0 and the member, 1 if there is no such name and -1 on a read error*/
+int pack_find(struct pack_reader *r, const char *name, struct pack_member *m);
+
+/*the i-th member, in archive order. returns 1 on a read error*/
+int pack_member_at(struct pack_reader *r, uint64_t i, struct pack_member *m);
+
+#endif
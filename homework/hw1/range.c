@@ -0,0 +1,84 @@
+#define _GNU_SOURCE
+#include<sys/types.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+#include "range.h"
+#include "xor_kernel.h"
+
+#define PATTERN_SIZE    4096            //short keys are XORed a whole pattern at a time
+#define MIN(x, y)       (((x) < (y)) ? (x) : (y))
+
+static ssize_t pread_full(int fd, char *buf, size_t len, off_t off);
+
+void range_xor(char *buf, size_t len, uint64_t off, const char *key, size_t key_size) {
+    char pattern[PATTERN_SIZE];
+    size_t k = (size_t)(off % key_size), plen, n, i;
+
+    //a long key is contiguous from k on - XOR against it directly
+    if (key_size >= PATTERN_SIZE) {
+        for (; len > 0; len -= n, buf += n, k = 0) {
+            n = MIN(len, key_size - k);
+            xor_buf(buf, buf, key + k, n);
+        }
+        return;
+    }
+
+    //a short one is repeated, starting at k, as many whole times as fit
+    plen = PATTERN_SIZE - PATTERN_SIZE % key_size;
+    for (i = 0; i < plen; i++)
+        pattern[i] = key[(k + i) % key_size];
+    for (; len > 0; len -= n, buf += n) {
+        n = MIN(len, plen);
+        xor_buf(buf, buf, pattern, n);
+    }
+}
+
+void range_xor_chacha(char *buf, size_t len, uint64_t off, const struct chacha *c) {
+    uint8_t stream[PATTERN_SIZE + CHACHA_BLOCK];
+    size_t skip, n;
+
+    for (; len > 0; len -= n, buf += n, off += n) {
+        skip = (size_t)(off % CHACHA_BLOCK);
+        n = MIN(len, PATTERN_SIZE);
+        chacha_blocks(c, off / CHACHA_BLOCK,
+                      (skip + n + CHACHA_BLOCK - 1) / CHACHA_BLOCK, stream);
+        xor_buf(buf, buf, (const char *)stream + skip, n);
+    }
+}
+
+/* like pread, but only stops short at the end of the file */
+static ssize_t pread_full(int fd, char *buf, size_t len, off_t off) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        n = pread(fd, buf + done, len - done, off + (off_t)done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (!n)
+            break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+ssize_t range_pread(int fd, void *buf, size_t len, off_t off,
+                    const char *key, size_t key_size) {
+    ssize_t n = pread_full(fd, (char *)buf, len, off);
+
+    if (n > 0)
+        range_xor((char *)buf, (size_t)n, (uint64_t)off, key, key_size);
+    return n;
+}
+
+ssize_t range_pread_chacha(int fd, void *buf, size_t len, off_t off,
+                           const struct chacha *c) {
+    ssize_t n = pread_full(fd, (char *)buf, len, off);
+
+    if (n > 0)
+        range_xor_chacha((char *)buf, (size_t)n, (uint64_t)off, c);
+    return n;
+}
@@ -0,0 +1,27 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include<sys/types.h>
+#include<stddef.h>
+#include<stdint.h>
+#include "chacha20.h"
+
+/* the key byte for file offset off is key[off % key_size] (or ChaCha20
+ * keystream byte off), so any byte range of a target decrypts on its own.
+ * call xor_init() (and chacha_init()) first. */
+
+/*XORs len bytes that sit at file offset off with the repeating key*/
+void range_xor(char *buf, size_t len, uint64_t off, const char *key, size_t key_size);
+
+/*XORs len bytes that sit at file offset off with the ChaCha20 keystream*/
+void range_xor_chacha(char *buf, size_t len, uint64_t off, const struct chacha *c);
+
+/*pread() of a target that returns plaintext: up to len bytes at off (fewer
+ * only at the end of the file). returns the byte count, or -1 and errno*/
+ssize_t range_pread(int fd, void *buf, size_t len, off_t off,
+                    const char *key, size_t key_size);
+
+ssize_t range_pread_chacha(int fd, void *buf, size_t len, off_t off,
+                           const struct chacha *c);
+
+#endif
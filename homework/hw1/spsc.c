@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include<unistd.h>
+#include<time.h>
+#include<limits.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
+#include "spsc.h"
+
+#define SPIN_TRIES      256             //polls before parking
+#define PARK_NSEC       1000000         //bounds a wakeup lost to *stop
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(_Atomic unsigned *addr, unsigned val) {
+    struct timespec ts = { 0, PARK_NSEC };
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static void futex_wake(_Atomic unsigned *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+void spsc_init(struct spsc *q) {
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->parked, 0);
+}
+
+int spsc_push(struct spsc *q, void *item) {
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(&q->head, memory_order_acquire) == SPSC_CAP)
+        return 1;
+    q->slots[tail & (SPSC_CAP - 1)] = item;
+    //seq_cst pairs with the consumer's parked/tail check below
+    atomic_store(&q->tail, tail + 1);
+    if (atomic_load(&q->parked))
+        futex_wake(&q->tail);
+    return 0;
+}
+
+int spsc_pop(struct spsc *q, void **item, const _Atomic int *stop) {
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail;
+    int spins = 0;
+
+    while ((tail = atomic_load_explicit(&q->tail, memory_order_acquire)) == head) {
+        if (atomic_load_explicit(stop, memory_order_relaxed))
+            return 1;
+        if (spins++ < SPIN_TRIES) {
+            cpu_relax();
+            continue;
+        }
+        atomic_store(&q->parked, 1);
+        if (atomic_load(&q->tail) == head)
+            futex_wait(&q->tail, head);
+        atomic_store(&q->parked, 0);
+    }
+    *item = q->slots[head & (SPSC_CAP - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+void spsc_wake(struct spsc *q) {
+    futex_wake(&q->tail);
+}
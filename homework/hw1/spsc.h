@@ -0,0 +1,37 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include<stdatomic.h>
+
+#define SPSC_CAP        16      //slots per queue (power of two)
+
+/*
+ * lock-free single-producer/single-consumer queue of pointers. the
+ * producer only writes tail and the consumer only writes head, so the fast
+ * path is a pair of acquire/release accesses. an empty queue parks its
+ * consumer on a futex instead of spinning, since the stage on the other
+ * side is often blocked in the kernel.
+ */
+struct spsc {
+    _Atomic unsigned head;              //next slot to pop (consumer)
+    char pad1[64 - sizeof(unsigned)];   //keep the two ends on their own lines
+    _Atomic unsigned tail;              //next slot to push (producer)
+    _Atomic int      parked;            //consumer is (about to be) asleep
+    char pad2[64 - sizeof(unsigned) - sizeof(int)];
+    void *slots[SPSC_CAP];
+};
+
+/*empties the queue*/
+void spsc_init(struct spsc *q);
+
+/*appends item. returns 1 if the queue is full*/
+int spsc_push(struct spsc *q, void *item);
+
+/*removes the oldest item into *item, waiting while the queue is empty.
+ *returns 1 (with nothing removed) once *stop is set*/
+int spsc_pop(struct spsc *q, void **item, const _Atomic int *stop);
+
+/*wakes the consumer so it notices *stop*/
+void spsc_wake(struct spsc *q);
+
+#endif
@@ -0,0 +1,166 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<limits.h>
+#include<pthread.h>
+#include "stats.h"
+
+#define HIST_BUCKETS    65              //bucket b: [2^(b-1), 2^b), bucket 0: 0
+#define LINE_SIZE       (PATH_MAX * 6 + 1024)
+
+static const char *phase_names[PH_NUM] = { "open", "read", "xor", "write", "close" };
+
+struct stats {
+    FILE     *out;
+    pthread_mutex_t lock;
+    int      err;                       //a write failed
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t ns[PH_NUM];
+    uint64_t calls[PH_NUM];
+    uint64_t hist_total[HIST_BUCKETS];  //usec per file
+    uint64_t hist[PH_NUM][HIST_BUCKETS];
+    uint64_t hist_bytes[HIST_BUCKETS];
+};
+
+static int bucket(uint64_t v);
+static size_t json_path(char *out, size_t size, const char *path);
+static void put_hist(FILE *out, const char *name, const uint64_t *hist, int last);
+
+static int bucket(uint64_t v) {
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+/* the path as a JSON string - quotes, backslashes and control bytes escaped */
+static size_t json_path(char *out, size_t size, const char *path) {
+    const unsigned char *p;
+    size_t n = 0;
+
+    out[n++] = '"';
+    for (p = (const unsigned char *)path; *p && n + 8 < size; p++) {
+        if (*p == '"' || *p == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)*p;
+        } else if (*p < 0x20) {
+            n += (size_t)snprintf(out + n, size - n, "\\u%04x", *p);
+        } else {
+            out[n++] = (char)*p;
+        }
+    }
+    out[n++] = '"';
+    out[n] = '\0';
+    return n;
+}
+
+struct stats *stats_open(FILE *out) {
+    struct stats *s = (struct stats *) calloc (1, sizeof(struct stats));
+
+    if (!s)
+        return NULL;
+    s->out = out;
+    pthread_mutex_init(&s->lock, NULL);
+    return s;
+}
+
+void stats_file(struct stats *s, const char *path, uint64_t bytes, uint64_t total_ns,
+                const struct file_trace *t) {
+    char line[LINE_SIZE];
+    uint64_t ns[PH_NUM], calls[PH_NUM], syscalls = 0;
+    size_t n;
+    int i;
+
+    //the last chunk of a split file can still race with a slow trace_end()
+    for (i = 0; i < PH_NUM; i++) {
+        ns[i] = __atomic_load_n(&t->ns[i], __ATOMIC_RELAXED);
+        calls[i] = __atomic_load_n(&t->calls[i], __ATOMIC_RELAXED);
+        if (i != PH_XOR)
+            syscalls += calls[i];
+    }
+
+    //formatted outside the lock - only the write is serialized
+    n = (size_t)snprintf(line, sizeof(line), "{\"file\":");
+    n += json_path(line + n, sizeof(line) - n, path);
+    n += (size_t)snprintf(line + n, sizeof(line) - n,
+                          ",\"bytes\":%llu,\"ns\":{\"total\":%llu",
+                          (unsigned long long)bytes, (unsigned long long)total_ns);
+    for (i = 0; i < PH_NUM; i++)
+        n += (size_t)snprintf(line + n, sizeof(line) - n, ",\"%s\":%llu",
+                              phase_names[i], (unsigned long long)ns[i]);
+    n += (size_t)snprintf(line + n, sizeof(line) - n, "},\"calls\":{");
+    for (i = 0; i < PH_NUM; i++)
+        n += (size_t)snprintf(line + n, sizeof(line) - n, "%s\"%s\":%llu",
+                              i ? "," : "", phase_names[i], (unsigned long long)calls[i]);
+    snprintf(line + n, sizeof(line) - n, "},\"syscalls\":%llu}\n",
+             (unsigned long long)syscalls);
+
+    /**CS**/
+    pthread_mutex_lock(&s->lock);
+    if (fputs(line, s->out) == EOF)
+        s->err = 1;
+    s->files++;
+    s->bytes += bytes;
+    s->hist_total[bucket(total_ns / 1000)]++;
+    s->hist_bytes[bucket(bytes)]++;
+    for (i = 0; i < PH_NUM; i++) {
+        s->ns[i] += ns[i];
+        s->calls[i] += calls[i];
+        if (calls[i])
+            s->hist[i][bucket(ns[i] / 1000)]++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    /**CS-END**/
+}
+
+static void put_hist(FILE *out, const char *name, const uint64_t *hist, int last) {
+    int b, first = 1;
+
+    if (name)
+        fprintf(out, "\"%s\":", name);
+    fputc('[', out);
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        if (!hist[b])
+            continue;
+        fprintf(out, "%s{\"lo\":%llu,\"hi\":", first ? "" : ",",
+                b ? 1ULL << (b - 1) : 0ULL);
+        //the top bucket's bound doesn't fit 64 bits
+        if (b < 64)
+            fprintf(out, "%llu", 1ULL << b);
+        else
+            fputs("18446744073709551616", out);
+        fprintf(out, ",\"n\":%llu}", (unsigned long long)hist[b]);
+        first = 0;
+    }
+    fputs(last ? "]" : "],", out);
+}
+
+int stats_close(struct stats *s, uint64_t wall_ns) {
+    uint64_t syscalls = 0;
+    int i, rc;
+
+    for (i = 0; i < PH_NUM; i++)
+        if (i != PH_XOR)
+            syscalls += s->calls[i];
+
+    fprintf(s->out, "{\"summary\":{\"files\":%llu,\"bytes\":%llu,\"wall_ns\":%llu,\"ns\":{",
+            (unsigned long long)s->files, (unsigned long long)s->bytes,
+            (unsigned long long)wall_ns);
+    for (i = 0; i < PH_NUM; i++)
+        fprintf(s->out, "%s\"%s\":%llu", i ? "," : "", phase_names[i],
+                (unsigned long long)s->ns[i]);
+    fputs("},\"calls\":{", s->out);
+    for (i = 0; i < PH_NUM; i++)
+        fprintf(s->out, "%s\"%s\":%llu", i ? "," : "", phase_names[i],
+                (unsigned long long)s->calls[i]);
+    fprintf(s->out, "},\"syscalls\":%llu,\"hist_us\":{", (unsigned long long)syscalls);
+    put_hist(s->out, "total", s->hist_total, 0);
+    for (i = 0; i < PH_NUM; i++)
+        put_hist(s->out, phase_names[i], s->hist[i], i == PH_NUM - 1);
+    fputs("},\"hist_bytes\":", s->out);
+    put_hist(s->out, NULL, s->hist_bytes, 1);
+    fputs("}}\n", s->out);
+
+    rc = s->err || fflush(s->out) == EOF || ferror(s->out);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    return rc;
+}
@@ -0,0 +1,40 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include<stdio.h>
+#include<stdint.h>
+
+/*
+ * --stats json: one JSON object per encrypted file, one line each, then a
+ * summary line with the totals and log2 histograms when the run ends:
+ *
+ *   {"file":"sub/a","bytes":1024,"ns":{"total":..,"open":..,..},"calls":{..},"syscalls":5}
+ *   {"summary":{"files":..,"bytes":..,"wall_ns":..,"ns":{..},"calls":{..},
+ *               "syscalls":..,"hist_us":{"total":[..],"open":[..],..},"hist_bytes":[..]}}
+ *
+ * a histogram lists its non-empty buckets as {"lo":x,"hi":y,"n":count},
+ * each holding the values in [lo, hi). the calls of xor are the blocks
+ * XORed - every other phase counts its syscalls.
+ */
+enum phase { PH_OPEN, PH_READ, PH_XOR, PH_WRITE, PH_CLOSE, PH_NUM };
+
+/* where one file's time went. phases may run on several threads at once
+ * (split files, --pipeline), so writers add to it atomically */
+struct file_trace {
+    uint64_t ns[PH_NUM];
+    uint64_t calls[PH_NUM];
+};
+
+struct stats;
+
+/*returns NULL if out of memory*/
+struct stats *stats_open(FILE *out);
+
+/*writes the line of one file and adds it to the totals - thread safe*/
+void stats_file(struct stats *s, const char *path, uint64_t bytes, uint64_t total_ns,
+                const struct file_trace *t);
+
+/*writes the summary and frees s. returns 1 if any write failed*/
+int stats_close(struct stats *s, uint64_t wall_ns);
+
+#endif
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "uring.h"
+
+int uring_init(struct uring *r, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(struct uring));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len)
+            r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    r->sq_entries = p.sq_entries;
+    r->sq_head  = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail  = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head  = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    r->sqe_tail = *r->sq_tail;
+    return 0;
+
+fail:
+    if (r->sq_ptr == MAP_FAILED)
+        r->sq_ptr = NULL;
+    uring_exit(r);
+    return -1;
+}
+
+void uring_exit(struct uring *r) {
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->fd >= 0)
+        close(r->fd);
+    r->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (r->sqe_tail - head >= r->sq_entries)
+        return NULL;
+    sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+    r->sq_array[r->sqe_tail & *r->sq_mask] = r->sqe_tail & *r->sq_mask;
+    r->sqe_tail++;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(struct uring *r, unsigned wait_nr) {
+    unsigned to_submit = r->sqe_tail - *r->sq_tail;
+    int rc;
+
+    //make the new entries visible to the kernel
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    do {
+        rc = (int)syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr,
+                          wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (rc < 0 && errno == EINTR);
+    return rc;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *r) {
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register(struct uring *r, unsigned opcode, void *arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, r->fd, opcode, arg, nr);
+}
+
+int uring_supports(struct uring *r, const int *ops, int n) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *) calloc (1, len);
+    int i, ok = 1;
+
+    if (!probe)
+        return 0;
+    if (uring_register(r, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        free(probe);
+        return 0;
+    }
+    for (i = 0; i < n && ok; i++) {
+        ok = ops[i] <= probe->last_op &&
+             (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+int uring_supports_direct(struct uring *r) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int res;
+
+    //pre-5.15 kernels ignore file_index and hand back a regular descriptor
+    sqe = uring_get_sqe(r);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (__u64)(unsigned long)"/";
+    sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    sqe->file_index = 1;
+    if (uring_submit_and_wait(r, 1) < 0 || !(cqe = uring_peek_cqe(r)))
+        return 0;
+    res = cqe->res;
+    uring_cqe_seen(r);
+    if (res > 0)
+        close(res);
+    if (res)
+        return 0;
+
+    //and closing by file_index came with it
+    sqe = uring_get_sqe(r);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 1;
+    if (uring_submit_and_wait(r, 1) < 0 || !(cqe = uring_peek_cqe(r)))
+        return 0;
+    res = cqe->res;
+    uring_cqe_seen(r);
+    return !res;
+}
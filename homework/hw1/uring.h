@@ -0,0 +1,55 @@
+#ifndef URING_H
+#define URING_H
+
+#include<linux/io_uring.h>
+
+/* minimal io_uring plumbing (raw syscalls - no liburing dependency) */
+struct uring {
+    int                 fd;
+    unsigned            sq_entries;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned            sqe_tail;   //sqes handed out but not yet published
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;
+    void                *cq_ptr;
+    size_t              sq_len;
+    size_t              cq_len;
+    size_t              sqes_len;
+};
+
+/*sets up a ring with (at least) entries submission slots*/
+int uring_init(struct uring *r, unsigned entries);
+
+/*unmaps and closes the ring*/
+void uring_exit(struct uring *r);
+
+/*returns a zeroed submission entry, or NULL if the queue is full*/
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+/*publishes the pending entries and waits for wait_nr completions*/
+int uring_submit_and_wait(struct uring *r, unsigned wait_nr);
+
+/*returns the next completion, or NULL if none is ready*/
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+
+/*marks the completion returned by uring_peek_cqe() as consumed*/
+void uring_cqe_seen(struct uring *r);
+
+/*io_uring_register(2) wrapper*/
+int uring_register(struct uring *r, unsigned opcode, void *arg, unsigned nr);
+
+/*returns 1 if the kernel supports every opcode in ops*/
+int uring_supports(struct uring *r, const int *ops, int n);
+
+/*returns 1 if OPENAT and CLOSE work on fixed file slots (file_index).
+ *the file table must be registered, with its first slot free*/
+int uring_supports_direct(struct uring *r);
+
+#endif
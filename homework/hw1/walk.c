@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<dirent.h>
+#include "walk.h"
+
+#define DENTS_BUF_SIZE  (256 * 1024)    //directory records fetched per getdents64
+#define DIR_MODE        (S_IRWXU | S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH)
+
+static int is_ignored(const char *name);
+static int walker_push(struct walker *w, struct dir_node *dir);
+static void walker_pop(struct walker *w);
+static int walker_enter(struct walker *w, struct dir_node *parent, const char *name);
+
+static int is_ignored(const char *name) {
+    return name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]));
+}
+
+struct dir_node *dir_node_create(int src_fd, int tgt_fd, const char *src_path,
+                                 const char *tgt_path, const char *rel_path) {
+    struct dir_node *dir = (struct dir_node *) malloc (sizeof(struct dir_node));
+
+    if (!dir)
+        return NULL;
+    dir->src_path = strdup(src_path);
+    dir->tgt_path = strdup(tgt_path);
+    dir->rel_path = strdup(rel_path);
+    if (!dir->src_path || !dir->tgt_path || !dir->rel_path) {
+        free(dir->src_path);
+        free(dir->tgt_path);
+        free(dir->rel_path);
+        free(dir);
+        return NULL;
+    }
+    dir->src_fd = src_fd;
+    dir->tgt_fd = tgt_fd;
+    dir->refs = 1;
+    return dir;
+}
+
+void dir_get(struct dir_node *dir) {
+    __atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+}
+
+void dir_put(struct dir_node *dir) {
+    if (__atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    close(dir->src_fd);
+    if (dir->tgt_fd >= 0)
+        close(dir->tgt_fd);
+    free(dir->src_path);
+    free(dir->tgt_path);
+    free(dir->rel_path);
+    free(dir);
+}
+
+static int walker_push(struct walker *w, struct dir_node *dir) {
+    struct walk_level *stack;
+    char *buf;
+
+    if (w->depth == w->cap) {
+        stack = (struct walk_level *) realloc (w->stack,
+                            (size_t)(w->cap * 2 + 4) * sizeof(struct walk_level));
+        if (!stack)
+            return 1;
+        w->stack = stack;
+        w->cap = w->cap * 2 + 4;
+    }
+    buf = (char *) malloc (DENTS_BUF_SIZE);
+    if (!buf)
+        return 1;
+    w->stack[w->depth].dir = dir;
+    w->stack[w->depth].buf = buf;
+    w->stack[w->depth].len = 0;
+    w->stack[w->depth].pos = 0;
+    w->depth++;
+    return 0;
+}
+
+static void walker_pop(struct walker *w) {
+    w->depth--;
+    free(w->stack[w->depth].buf);
+    dir_put(w->stack[w->depth].dir);
+}
+
+int walker_init(struct walker *w, struct dir_node *root, int recursive) {
+    struct stat st;
+
+    memset(w, 0, sizeof(struct walker));
+    w->recursive = recursive;
+    //with -r, walking a target under the source would encrypt its own output
+    if (root->tgt_fd >= 0 && !fstat(root->tgt_fd, &st)) {
+        w->tgt_dev = st.st_dev;
+        w->tgt_ino = st.st_ino;
+    }
+    //getdents64 reads on from the fd's offset - the root may have been walked before
+    lseek(root->src_fd, 0, SEEK_SET);
+    if (walker_push(w, root)) {
+        dir_put(root);
+        return 1;
+    }
+    return 0;
+}
+
+int dir_node_enter(struct dir_node *parent, const char *name, struct dir_node **dir) {
+    char *src_path, *tgt_path, *rel_path;
+    int src_fd, tgt_fd = -1;
+
+    *dir = NULL;
+    if (asprintf(&src_path, "%s/%s", parent->src_path, name) < 0)
+        return -1;
+    if (asprintf(&tgt_path, "%s/%s", parent->tgt_path, name) < 0) {
+        free(src_path);
+        return -1;
+    }
+    if (asprintf(&rel_path, "%s%s%s", parent->rel_path,
+                 parent->rel_path[0] ? "/" : "", name) < 0) {
+        free(src_path);
+        free(tgt_path);
+        return -1;
+    }
+
+    src_fd = openat(parent->src_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (src_fd < 0) {
+        printf("ERROR: Failed to open dir [%s]\n"
+               "Cause: %s [%d]\n",
+               src_path, strerror(errno), errno);
+        free(src_path);
+        free(tgt_path);
+        free(rel_path);
+        return 1;
+    }
+    //--pack has no target tree to mirror
+    if (parent->tgt_fd < 0)
+        goto create;
+    if (mkdirat(parent->tgt_fd, name, DIR_MODE) && errno != EEXIST) {
+        printf("ERROR: Failed to create dir [%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, strerror(errno), errno);
+        goto fatal;
+    }
+    tgt_fd = openat(parent->tgt_fd, name, O_RDONLY | O_DIRECTORY);
+    if (tgt_fd < 0) {
+        printf("ERROR: Failed to open dir [%s]\n"
+               "Cause: %s [%d]\n",
+               tgt_path, strerror(errno), errno);
+        goto fatal;
+    }
+create:
+    *dir = dir_node_create(src_fd, tgt_fd, src_path, tgt_path, rel_path);
+    if (!*dir)
+        goto fatal;
+    free(src_path);
+    free(tgt_path);
+    free(rel_path);
+    return 0;
+
+fatal:
+    close(src_fd);
+    if (tgt_fd >= 0)
+        close(tgt_fd);
+    free(src_path);
+    free(tgt_path);
+    free(rel_path);
+    return -1;
+}
+
+/* descends into a subdirectory. returns 1 if it was skipped and -1 on a
+ * fatal error */
+static int walker_enter(struct walker *w, struct dir_node *parent, const char *name) {
+    struct dir_node *dir;
+    int rc;
+
+    rc = dir_node_enter(parent, name, &dir);
+    if (rc)
+        return rc;
+    if (w->on_enter)
+        w->on_enter(w->arg, dir);
+    if (walker_push(w, dir)) {
+        dir_put(dir);
+        return -1;
+    }
+    return 0;
+}
+
+int walker_next(struct walker *w, struct dir_node **dir, const char **name) {
+    struct walk_level *lvl;
+    struct dirent64 *ent;
+    struct stat st;
+    unsigned char type;
+    int rc;
+
+    while (w->depth > 0) {
+        lvl = &w->stack[w->depth - 1];
+
+        //refill the batch of records
+        if (lvl->pos >= lvl->len) {
+            lvl->len = (long)getdents64(lvl->dir->src_fd, lvl->buf, DENTS_BUF_SIZE);
+            lvl->pos = 0;
+            if (lvl->len < 0) {
+                printf("ERROR: Failed to read dir [%s]\n"
+                       "Cause: %s [%d]\n",
+                       lvl->dir->src_path, strerror(errno), errno);
+                w->rc = 1;
+                w->incomplete = 1;
+                lvl->len = 0;
+            }
+            if (lvl->len == 0) {    //done with this directory
+                walker_pop(w);
+                continue;
+            }
+        }
+
+        ent = (struct dirent64 *)(lvl->buf + lvl->pos);
+        lvl->pos += ent->d_reclen;
+        if (is_ignored(ent->d_name) ||
+            (w->depth == 1 && w->skip_name && !strcmp(ent->d_name, w->skip_name)))
+            continue;
+
+        //only stat when the filesystem doesn't report the type
+        type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            if (fstatat(lvl->dir->src_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+                printf("ERROR: Failed to stat [%s/%s]\n"
+                       "Cause: %s [%d]\n",
+                       lvl->dir->src_path, ent->d_name, strerror(errno), errno);
+                w->rc = 1;
+                w->incomplete = 1;
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+
+        if (type == DT_DIR) {
+            if (!w->recursive) {
+                printf("WARNING: [%s/%s] is a directory\n"
+                       "Skipping (use -r to descend)...\n",
+                       lvl->dir->src_path, ent->d_name);
+                w->rc = 1;
+                continue;
+            }
+            //d_ino is enough to rule it out without a stat
+            if (w->tgt_ino && ent->d_ino == w->tgt_ino &&
+                !fstatat(lvl->dir->src_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) &&
+                st.st_dev == w->tgt_dev && st.st_ino == w->tgt_ino)
+                continue;
+            rc = walker_enter(w, lvl->dir, ent->d_name);
+            if (rc < 0)
+                return -1;
+            w->rc |= rc;
+            w->incomplete |= rc;
+            continue;
+        }
+
+        *dir = lvl->dir;
+        *name = ent->d_name;
+        return 1;
+    }
+    w->done = 1;
+    return 0;
+}
+
+void walker_destroy(struct walker *w) {
+    while (w->depth > 0)
+        walker_pop(w);
+    free(w->stack);
+    w->stack = NULL;
+}
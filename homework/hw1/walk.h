@@ -0,0 +1,67 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include<sys/types.h>
+
+/* a source directory and its mirror in the target tree. entries are
+ * opened relative to the fds, the paths are only used for messages */
+struct dir_node {
+    int  src_fd;
+    int  tgt_fd;                //-1 when there is no target tree (--pack)
+    char *src_path;
+    char *tgt_path;
+    char *rel_path;             //relative to the roots ("" for the roots)
+    int  refs;
+};
+
+/* one directory being listed - a getdents64 batch at a time */
+struct walk_level {
+    struct dir_node *dir;
+    char            *buf;
+    long            len;        //bytes returned by the last getdents64
+    long            pos;        //next record in buf
+};
+
+/* depth-first iterator over the regular files of a tree */
+struct walker {
+    struct walk_level *stack;
+    int               depth;
+    int               cap;
+    int               recursive;
+    const char        *skip_name; //entry of the root dir to leave out (or NULL)
+    dev_t             tgt_dev;  //the target root, never walked into when it's
+    ino_t             tgt_ino;  //inside the source (0 without a target tree)
+    int               rc;       //1 if anything was skipped along the way
+    int               incomplete; //entries of a walked dir couldn't be listed
+    int               done;     //walker_next() reached the end of the tree
+    void              (*on_enter)(void *arg, struct dir_node *dir); //each subdir (or NULL)
+    void              *arg;
+};
+
+/*takes ownership of the fds, returns NULL on failure*/
+struct dir_node *dir_node_create(int src_fd, int tgt_fd, const char *src_path,
+                                 const char *tgt_path, const char *rel_path);
+
+/*mirrors the source subdirectory name of parent in the target tree and
+ * opens both sides. returns 1 if it was skipped and -1 on a fatal error*/
+int dir_node_enter(struct dir_node *parent, const char *name, struct dir_node **dir);
+
+/*takes a reference to the node*/
+void dir_get(struct dir_node *dir);
+
+/*drops a reference, closing the fds with the last one*/
+void dir_put(struct dir_node *dir);
+
+/*starts a walk at root (the walker takes the caller's reference). a
+ * target tree inside the source tree is left out of the walk*/
+int walker_init(struct walker *w, struct dir_node *root, int recursive);
+
+/*returns 1 and the next non-directory entry (name is valid until the
+ * next call, take a dir reference to keep dir), 0 at the end of the
+ * walk and -1 on a fatal error*/
+int walker_next(struct walker *w, struct dir_node **dir, const char **name);
+
+/*releases whatever the walk still holds*/
+void walker_destroy(struct walker *w);
+
+#endif
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include "xor_kernel.h"
+
+#define DEF_BUF_SIZE    (64 * 1024)
+#define DEF_SECONDS     1.0
+#define MISALIGN        3           //also exercise the unaligned head/tail
+
+void usage(char* filename);
+double now_sec(void);
+int check_kernel(const struct xor_kernel *k, char *src, char *key, size_t len);
+double bench_kernel(const struct xor_kernel *k, char *dst, char *src, char *key,
+                    size_t len, double seconds);
+
+void usage(char* filename) {
+    printf("Usage: %s (%s) (%s)\n"
+           "Aborting...\n",
+            filename,
+            "buffer_size",
+            "seconds_per_kernel");
+}
+
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//compares a kernel against the scalar one, over all short lengths and offsets
+int check_kernel(const struct xor_kernel *k, char *src, char *key, size_t len) {
+    const struct xor_kernel *ref = &xor_kernels[xor_kernels_num - 1];
+    char *a = (char *) malloc (len + 64);
+    char *b = (char *) malloc (len + 64);
+    size_t off, n;
+    int rc = 0;
+
+    if (!a || !b) {
+        free(a);
+        free(b);
+        return 1;
+    }
+    for (off = 0; off < 64 && !rc; off++) {
+        for (n = 0; n <= 300 && n <= len && !rc; n++) {
+            ref->fn(a + off, src, key, n);
+            k->fn(b + off, src, key, n);
+            rc = memcmp(a + off, b + off, n) != 0;
+        }
+    }
+    if (!rc) {
+        ref->fn(a, src, key, len);
+        k->fn(b, src, key, len);
+        rc = memcmp(a, b, len) != 0;
+    }
+    free(a);
+    free(b);
+    return rc;
+}
+
+double bench_kernel(const struct xor_kernel *k, char *dst, char *src, char *key,
+                    size_t len, double seconds) {
+    double t1, t2;
+    size_t bytes = 0;
+    size_t reps = (1 << 20) / len + 1;      //keep clock reads out of the loop
+    size_t r;
+
+    k->fn(dst, src, key, len);              //warm up caches
+    t1 = now_sec();
+    do {
+        for (r = 0; r < reps; r++)
+            k->fn(dst, src, key, len);
+        bytes += reps * len;
+        t2 = now_sec();
+    } while (t2 - t1 < seconds);
+
+    return bytes / (t2 - t1) / 1e9;
+}
+
+int main ( int argc, char *argv[]) {
+
+    if (argc > 3) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    size_t len = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : DEF_BUF_SIZE;
+    double seconds = argc > 2 ? strtod(argv[2], NULL) : DEF_SECONDS;
+    const struct xor_kernel *selected;
+    char *dst, *src, *key;
+    int i, rc = 0;
+    size_t j;
+
+    if (!len || seconds <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    dst = (char *) malloc (len + MISALIGN);
+    src = (char *) malloc (len + MISALIGN);
+    key = (char *) malloc (len + MISALIGN);
+    if (!dst || !src || !key) {
+        printf("ERROR: Failed to allocate buffers\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        rc = -1;
+        goto cleanup;
+    }
+    srand((unsigned int)time(NULL));
+    for (j = 0; j < len + MISALIGN; j++) {
+        src[j] = (char)rand();
+        key[j] = (char)rand();
+    }
+
+    selected = xor_init();
+    printf("kernel,selected,aligned_GBps,unaligned_GBps\n");
+    for (i = 0; i < xor_kernels_num; i++) {
+        const struct xor_kernel *k = &xor_kernels[i];
+        if (!k->supported()) {
+            printf("%s,unsupported,,\n", k->name);
+            continue;
+        }
+        if (check_kernel(k, src, key, len)) {
+            printf("ERROR: kernel [%s] disagrees with scalar kernel\n", k->name);
+            rc = -1;
+            continue;
+        }
+        printf("%s,%s,%.2f,%.2f\n", k->name, k == selected ? "yes" : "no",
+               bench_kernel(k, dst, src, key, len, seconds),
+               bench_kernel(k, dst + MISALIGN, src + 1, key + 2, len, seconds));
+    }
+
+cleanup:
+    free(dst);
+    free(src);
+    free(key);
+    return rc;
+}
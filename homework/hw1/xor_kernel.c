@@ -0,0 +1,159 @@
+#include<stdint.h>
+#include<string.h>
+#include "xor_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define XOR_X86 1
+#endif
+
+static void xor_scalar(char *dst, const char *src, const char *key, size_t len);
+
+xor_fn_t xor_buf = xor_scalar;
+
+/*Scalar fallback - one machine word at a time*/
+static void xor_scalar(char *dst, const char *src, const char *key, size_t len) {
+    uint64_t s, k;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        memcpy(&s, src + i, sizeof(s));
+        memcpy(&k, key + i, sizeof(k));
+        s ^= k;
+        memcpy(dst + i, &s, sizeof(s));
+    }
+    for (; i < len; i++)
+        dst[i] = src[i] ^ key[i];
+}
+
+static int always(void) {
+    return 1;
+}
+
+#ifdef XOR_X86
+
+//bytes to process one at a time until dst is aligned to width
+static size_t head_len(const char *dst, size_t width, size_t len) {
+    size_t mis = (uintptr_t)dst & (width - 1);
+    size_t head = mis ? width - mis : 0;
+    return head < len ? head : len;
+}
+
+__attribute__((target("sse2")))
+static void xor_sse2(char *dst, const char *src, const char *key, size_t len) {
+    size_t i = head_len(dst, 16, len);
+    __m128i a, b, c, d;
+
+    xor_scalar(dst, src, key, i);
+    for (; i + 64 <= len; i += 64) {
+        a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)),
+                          _mm_loadu_si128((const __m128i *)(key + i)));
+        b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i + 16)),
+                          _mm_loadu_si128((const __m128i *)(key + i + 16)));
+        c = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i + 32)),
+                          _mm_loadu_si128((const __m128i *)(key + i + 32)));
+        d = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i + 48)),
+                          _mm_loadu_si128((const __m128i *)(key + i + 48)));
+        _mm_store_si128((__m128i *)(dst + i), a);
+        _mm_store_si128((__m128i *)(dst + i + 16), b);
+        _mm_store_si128((__m128i *)(dst + i + 32), c);
+        _mm_store_si128((__m128i *)(dst + i + 48), d);
+    }
+    for (; i + 16 <= len; i += 16) {
+        a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)),
+                          _mm_loadu_si128((const __m128i *)(key + i)));
+        _mm_store_si128((__m128i *)(dst + i), a);
+    }
+    xor_scalar(dst + i, src + i, key + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(char *dst, const char *src, const char *key, size_t len) {
+    size_t i = head_len(dst, 32, len);
+    __m256i a, b, c, d;
+
+    xor_scalar(dst, src, key, i);
+    for (; i + 128 <= len; i += 128) {
+        a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i)),
+                             _mm256_loadu_si256((const __m256i *)(key + i)));
+        b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i + 32)),
+                             _mm256_loadu_si256((const __m256i *)(key + i + 32)));
+        c = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i + 64)),
+                             _mm256_loadu_si256((const __m256i *)(key + i + 64)));
+        d = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i + 96)),
+                             _mm256_loadu_si256((const __m256i *)(key + i + 96)));
+        _mm256_store_si256((__m256i *)(dst + i), a);
+        _mm256_store_si256((__m256i *)(dst + i + 32), b);
+        _mm256_store_si256((__m256i *)(dst + i + 64), c);
+        _mm256_store_si256((__m256i *)(dst + i + 96), d);
+    }
+    for (; i + 32 <= len; i += 32) {
+        a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i)),
+                             _mm256_loadu_si256((const __m256i *)(key + i)));
+        _mm256_store_si256((__m256i *)(dst + i), a);
+    }
+    xor_scalar(dst + i, src + i, key + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+static void xor_avx512(char *dst, const char *src, const char *key, size_t len) {
+    size_t i = head_len(dst, 64, len);
+    __m512i a, b;
+
+    xor_scalar(dst, src, key, i);
+    for (; i + 128 <= len; i += 128) {
+        a = _mm512_xor_si512(_mm512_loadu_si512(src + i),
+                             _mm512_loadu_si512(key + i));
+        b = _mm512_xor_si512(_mm512_loadu_si512(src + i + 64),
+                             _mm512_loadu_si512(key + i + 64));
+        _mm512_store_si512(dst + i, a);
+        _mm512_store_si512(dst + i + 64, b);
+    }
+    for (; i + 64 <= len; i += 64) {
+        a = _mm512_xor_si512(_mm512_loadu_si512(src + i),
+                             _mm512_loadu_si512(key + i));
+        _mm512_store_si512(dst + i, a);
+    }
+    xor_scalar(dst + i, src + i, key + i, len - i);
+}
+
+static int has_sse2(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+static int has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static int has_avx512(void) {
+    return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+const struct xor_kernel xor_kernels[] = {
+#ifdef XOR_X86
+    { "avx512", xor_avx512, has_avx512 },
+    { "avx2",   xor_avx2,   has_avx2 },
+    { "sse2",   xor_sse2,   has_sse2 },
+#endif
+    { "scalar", xor_scalar, always },
+};
+
+const int xor_kernels_num = sizeof(xor_kernels) / sizeof(xor_kernels[0]);
+
+const struct xor_kernel *xor_init(void) {
+    int i;
+
+#ifdef XOR_X86
+    __builtin_cpu_init();
+#endif
+    for (i = 0; i < xor_kernels_num; i++) {
+        if (xor_kernels[i].supported()) {
+            xor_buf = xor_kernels[i].fn;
+            return &xor_kernels[i];
+        }
+    }
+    //unreachable - scalar is always supported
+    return &xor_kernels[xor_kernels_num - 1];
+}
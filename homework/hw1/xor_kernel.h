@@ -0,0 +1,26 @@
+#ifndef XOR_KERNEL_H
+#define XOR_KERNEL_H
+
+#include<stddef.h>
+
+/* dst[i] = src[i] ^ key[i] for i in [0, len). buffers may be unaligned,
+ * dst may alias src. */
+typedef void (*xor_fn_t)(char *dst, const char *src, const char *key, size_t len);
+
+struct xor_kernel {
+    const char *name;
+    xor_fn_t   fn;
+    int        (*supported)(void);  //runtime CPU check
+};
+
+/* all kernels compiled in, ordered from the widest to the scalar one */
+extern const struct xor_kernel xor_kernels[];
+extern const int xor_kernels_num;
+
+/* kernel used by xor_buf() - set by xor_init() */
+extern xor_fn_t xor_buf;
+
+/* picks the widest kernel this CPU supports and returns it */
+const struct xor_kernel *xor_init(void);
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef XOR_STREAM_HPP
+#define XOR_STREAM_HPP
+
+#include<algorithm>
+#include<cstddef>
+#include<cstdint>
+#include<cstring>
+#include<span>
+#include<stdexcept>
+#include<vector>
+
+extern "C" {
+#include "xor_kernel.h"
+}
+
+/*
+ * the cipher's XOR stream as a header-only library, for code that wants to
+ * encrypt buffers in process rather than run the cipher binary.
+ *
+ *   cipher::KeyTile<> key(key_bytes);
+ *   cipher::XorStream<cipher::KeyTile<>> xs(key);
+ *   xs.process(in, out, offset);     //out[i] = in[i] ^ key[(offset + i) % size]
+ *
+ * a stream holds no state between calls - the offset alone picks the key
+ * bytes, so blocks of a file may be processed in any order, by any thread.
+ * process() allocates nothing; only building a KeyTile does.
+ */
+namespace cipher {
+
+inline constexpr std::size_t dynamic_length = 0;
+
+/* the key repeated past its end, so any slice of up to block() bytes that
+ * starts inside the key is contiguous. Length fixes the key length at
+ * compile time - a power of two then wraps offsets with a mask */
+template <std::size_t Length = dynamic_length>
+class KeyTile {
+public:
+    static constexpr std::size_t default_block = 64 * 1024;
+
+    explicit KeyTile(std::span<const std::byte> key, std::size_t block = default_block)
+        : size_(key.size()), block_(block) {
+        if (key.empty() || !block)
+            throw std::invalid_argument("empty key or block");
+        if (Length != dynamic_length && key.size() != Length)
+            throw std::invalid_argument("key length does not match KeyTile<Length>");
+        tile_.resize(size_ + block_);
+        for (std::size_t i = 0; i < tile_.size(); i += std::min(size_, tile_.size() - i))
+            std::memcpy(tile_.data() + i, key.data(), std::min(size_, tile_.size() - i));
+    }
+
+    //position in the key of the byte for stream offset off
+    std::size_t wrap(std::uint64_t off) const noexcept {
+        if constexpr (Length == dynamic_length)
+            return static_cast<std::size_t>(off % size_);
+        else if constexpr ((Length & (Length - 1)) == 0)
+            return static_cast<std::size_t>(off & (Length - 1));
+        else
+            return static_cast<std::size_t>(off % Length);
+    }
+
+    //block() contiguous key bytes, from position pos (< size())
+    const std::byte *at(std::size_t pos) const noexcept { return tile_.data() + pos; }
+
+    std::size_t size() const noexcept { return size_; }
+    std::size_t block() const noexcept { return block_; }
+
+private:
+    std::vector<std::byte> tile_;
+    std::size_t size_;
+    std::size_t block_;
+};
+
+/* kernels: dst[i] = src[i] ^ key[i]. dst may alias src */
+
+/* Width bytes per step, in GCC vector registers - 16 is SSE2/NEON, 32 AVX2,
+ * 64 AVX-512 (when compiled for it; otherwise split into narrower ops) */
+template <std::size_t Width>
+struct VectorKernel {
+    static_assert(Width >= sizeof(std::uint64_t) && (Width & (Width - 1)) == 0,
+                  "vector width is a power of two, at least a word");
+    static constexpr std::size_t width = Width;
+
+    static void apply(std::byte *dst, const std::byte *src, const std::byte *key,
+                      std::size_t len) noexcept {
+        typedef unsigned char vec __attribute__((vector_size(Width)));
+        std::size_t i = 0;
+        vec s, k;
+
+        for (; i + Width <= len; i += Width) {
+            std::memcpy(&s, src + i, Width);
+            std::memcpy(&k, key + i, Width);
+            s ^= k;
+            std::memcpy(dst + i, &s, Width);
+        }
+        for (; i < len; i++)
+            dst[i] = src[i] ^ key[i];
+    }
+};
+
+using ScalarKernel = VectorKernel<sizeof(std::uint64_t)>;
+using Sse2Kernel = VectorKernel<16>;
+using Avx2Kernel = VectorKernel<32>;
+using Avx512Kernel = VectorKernel<64>;
+
+/* the widest kernel of xor_kernel.c this CPU runs - links xor_kernel.o,
+ * and xor_init() must have been called */
+struct RuntimeKernel {
+    static constexpr std::size_t width = 0;
+
+    static void apply(std::byte *dst, const std::byte *src, const std::byte *key,
+                      std::size_t len) noexcept {
+        xor_buf(reinterpret_cast<char *>(dst), reinterpret_cast<const char *>(src),
+                reinterpret_cast<const char *>(key), len);
+    }
+};
+
+template <class KeySource, class Kernel = RuntimeKernel>
+class XorStream {
+public:
+    //the key is borrowed, not copied - it must outlive the stream
+    explicit XorStream(const KeySource &key) noexcept : key_(key) {}
+    XorStream(const KeySource &&) = delete;
+
+    //in sits at stream offset offset. out holds at least in.size() bytes,
+    //and may be in itself
+    void process(std::span<const std::byte> in, std::span<std::byte> out,
+                 std::uint64_t offset) const {
+        std::size_t done, n;
+
+        if (out.size() < in.size())
+            throw std::length_error("output shorter than input");
+        for (done = 0; done < in.size(); done += n) {
+            n = std::min(in.size() - done, key_.block());
+            Kernel::apply(out.data() + done, in.data() + done,
+                          key_.at(key_.wrap(offset + done)), n);
+        }
+    }
+
+    void process(std::span<std::byte> buf, std::uint64_t offset) const {
+        process(std::span<const std::byte>(buf), buf, offset);
+    }
+
+private:
+    const KeySource &key_;
+};
+
+}
+
+#endif
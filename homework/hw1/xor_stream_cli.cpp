@@ -0,0 +1,106 @@
+/*
+ * xor_stream: cipher's XOR for a single file (or '-' for stdin/stdout), on
+ * top of xor_stream.hpp. the output matches cipher's for the same key.
+ *
+ *   xor_stream <src file> <key> <tgt file>
+ */
+#include<fcntl.h>
+#include<unistd.h>
+#include<cerrno>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<vector>
+#include "xor_stream.hpp"
+
+namespace {
+
+constexpr std::size_t BUF_SIZE = 1024 * 1024;
+
+int open_arg(const char *path, bool out) {
+    if (!std::strcmp(path, "-"))
+        return out ? STDOUT_FILENO : STDIN_FILENO;
+    return out ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666) : open(path, O_RDONLY);
+}
+
+bool read_key(const char *path, std::vector<std::byte> &key) {
+    std::byte buf[64 * 1024];
+    ssize_t n;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        key.insert(key.end(), buf, buf + n);
+    close(fd);
+    return !n && !key.empty();
+}
+
+bool write_all(int fd, const std::byte *buf, std::size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::byte> key_bytes, buf(BUF_SIZE);
+    std::uint64_t off = 0;
+    ssize_t n;
+    int src, tgt;
+
+    if (argc != 4) {
+        std::fprintf(stderr, "Usage: %s <src file> <key> <tgt file>\n"
+                     "('-' reads stdin / writes stdout)\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!read_key(argv[2], key_bytes)) {
+        std::fprintf(stderr, "ERROR: Failed to read key file [%s]\n"
+                     "Cause: %s [%d]\n", argv[2], std::strerror(errno), errno);
+        return EXIT_FAILURE;
+    }
+    src = open_arg(argv[1], false);
+    tgt = open_arg(argv[3], true);
+    if (src < 0 || tgt < 0) {
+        std::fprintf(stderr, "ERROR: Failed to open file [%s]\n"
+                     "Cause: %s [%d]\n", src < 0 ? argv[1] : argv[3],
+                     std::strerror(errno), errno);
+        return EXIT_FAILURE;
+    }
+
+    xor_init();
+    cipher::KeyTile<> key(key_bytes, BUF_SIZE);
+    cipher::XorStream<cipher::KeyTile<>> xs(key);
+
+    while ((n = read(src, buf.data(), buf.size())) > 0) {
+        std::span<std::byte> block(buf.data(), static_cast<std::size_t>(n));
+        xs.process(block, off);
+        if (!write_all(tgt, block.data(), block.size())) {
+            std::fprintf(stderr, "ERROR: Failed to write to file [%s]\n"
+                         "Cause: %s [%d]\n", argv[3], std::strerror(errno), errno);
+            return EXIT_FAILURE;
+        }
+        off += static_cast<std::uint64_t>(n);
+    }
+    if (n < 0) {
+        std::fprintf(stderr, "ERROR: Failed to read from file [%s]\n"
+                     "Cause: %s [%d]\n", argv[1], std::strerror(errno), errno);
+        return EXIT_FAILURE;
+    }
+    if (tgt != STDOUT_FILENO && close(tgt)) {
+        std::fprintf(stderr, "ERROR: Failed to close file [%s]\n"
+                     "Cause: %s [%d]\n", argv[3], std::strerror(errno), errno);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,922 @@
+#define _GNU_SOURCE
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/wait.h>
+#include<sys/resource.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<errno.h>
+#include<limits.h>
+#include<getopt.h>
+#include<signal.h>
+#include<time.h>
+#include<math.h>
+#include<poll.h>
+#include<mqueue.h>
+#include "shm_ring.h"
+
+/*
+ * ipc_bench: moves a payload from a writer process to a reader process over
+ * each transport, for a sweep of payload sizes, N times per case, and
+ * prints one CSV row per case.
+ *
+ * both children set up their end first, then wait for the go - a run is
+ * timed from the writer's first byte to the reader's last. the reader sums
+ * every byte it gets, so a transport that loses or reorders data fails.
+ */
+#define DEF_DIR         "/tmp"
+#define DEF_BLOCK       (64 * 1024)     //bytes per write/read call
+#define DEF_REPEATS     5
+#define DEF_MIN         1ULL
+#define DEF_MAX         (4ULL << 30)
+#define SIZE_STEP       4               //payload sizes grow by this factor
+#define MQ_MSG_SIZE     8192            //the unprivileged /proc/sys/fs/mqueue limits
+#define MQ_MAX_MSG      10
+#define RING_SIZE       (1024 * 1024)   //shm ring data bytes (power of two)
+#define MAX_RUNS        1000
+#define PERMISSIONS     0600
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+enum role { WRITER, READER };
+
+/* both ends of one run - set up by the parent, inherited by the children */
+struct channel {
+    char     path[PATH_MAX];    //fifo / mmap file / socket path / mq or shm name
+    int      fd;                //the end this child uses
+    int      fds[2];            //socketpair, mmap notification pipe
+    int      listen_fd;         //unix socket server
+    mqd_t    mq;
+    struct ring ring;           //shm: this child's end
+};
+
+struct transport {
+    const char *name;
+    int  (*setup)(struct channel *ch);                          //parent, before the fork
+    int  (*open)(struct channel *ch, enum role role);           //child, before the go
+    int  (*send)(struct channel *ch, const char *buf, size_t block, uint64_t size);
+    int  (*recv)(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum);
+    void (*teardown)(struct channel *ch);                       //parent, after both exit
+};
+
+/* what each child reports back */
+struct side_result {
+    int       role;
+    int       rc;
+    long long start_ns;
+    long long end_ns;
+    long long cpu_user_us;
+    long long cpu_sys_us;
+    uint64_t  sum;
+};
+
+/* one run of a case */
+struct run {
+    double    sec;
+    double    writer_user_ms, writer_sys_ms;
+    double    reader_user_ms, reader_sys_ms;
+};
+
+static struct {
+    const char *dir;
+    size_t   block;
+    int      repeats;
+    uint64_t min, max;
+    char     *transports;       //comma separated, NULL: all
+} opts = {
+    .dir = DEF_DIR,
+    .block = DEF_BLOCK,
+    .repeats = DEF_REPEATS,
+    .min = DEF_MIN,
+    .max = DEF_MAX,
+};
+
+void usage(char* filename);
+int parse_size(const char *str, uint64_t *size);
+long long now_nsec(void);
+long long tv_usec(struct timeval *tv);
+void fill_pattern(char *buf, size_t block);
+uint64_t pattern_sum(const char *buf, size_t block, uint64_t size);
+uint64_t byte_sum(const char *buf, size_t len);
+int write_all(int fd, const char *buf, size_t len);
+int send_fd(struct channel *ch, const char *buf, size_t block, uint64_t size);
+int recv_fd(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum);
+int fifo_setup(struct channel *ch);
+int fifo_open(struct channel *ch, enum role role);
+void path_teardown(struct channel *ch);
+int mmap_setup(struct channel *ch);
+int mmap_open(struct channel *ch, enum role role);
+int mmap_send(struct channel *ch, const char *buf, size_t block, uint64_t size);
+int mmap_recv(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum);
+void mmap_teardown(struct channel *ch);
+int unix_setup(struct channel *ch);
+int unix_open(struct channel *ch, enum role role);
+void unix_teardown(struct channel *ch);
+int pair_setup(struct channel *ch);
+int pair_open(struct channel *ch, enum role role);
+void pair_teardown(struct channel *ch);
+int mq_setup(struct channel *ch);
+int mq_open_end(struct channel *ch, enum role role);
+int mq_send_all(struct channel *ch, const char *buf, size_t block, uint64_t size);
+int mq_recv_all(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum);
+void mq_teardown(struct channel *ch);
+int shm_setup(struct channel *ch);
+int shm_open_end(struct channel *ch, enum role role);
+int shm_send(struct channel *ch, const char *buf, size_t block, uint64_t size);
+int shm_recv(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum);
+void shm_teardown(struct channel *ch);
+void child(const struct transport *t, struct channel *ch, enum role role, uint64_t size,
+           int up_fd, int go_fd);
+int ready_failed(const char *buf);
+int result_failed(const char *buf);
+int read_children(int up[2][2], char *bufs[2], size_t len, int (*failed)(const char *buf));
+int run_once(const struct transport *t, uint64_t size, uint64_t sum, struct run *run);
+void mean_ci(const double *v, int n, double *mean, double *ci);
+int bench_case(const struct transport *t, uint64_t size, uint64_t sum);
+int selected(const char *name);
+
+static const struct transport transports[] = {
+    { "fifo",       fifo_setup, fifo_open,    send_fd,     recv_fd,     path_teardown },
+    { "mmap",       mmap_setup, mmap_open,    mmap_send,   mmap_recv,   mmap_teardown },
+    { "unix",       unix_setup, unix_open,    send_fd,     recv_fd,     unix_teardown },
+    { "socketpair", pair_setup, pair_open,    send_fd,     recv_fd,     pair_teardown },
+    { "mq",         mq_setup,   mq_open_end,  mq_send_all, mq_recv_all, mq_teardown },
+    { "shm",        shm_setup,  shm_open_end, shm_send,    shm_recv,    shm_teardown },
+};
+static const int transports_num = sizeof(transports) / sizeof(transports[0]);
+
+void usage(char* filename) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  -t LIST   transports to run, comma separated (default: all of\n"
+            "            fifo,mmap,unix,socketpair,mq,shm)\n"
+            "  -m SIZE   smallest payload (default 1)\n"
+            "  -M SIZE   largest payload (default 4G) - sizes step by x%d\n"
+            "  -n N      runs per case (default %d)\n"
+            "  -b SIZE   bytes per write/read call (default 64K)\n"
+            "  -d DIR    where fifos, mmap files and sockets are created (default %s)\n"
+            "Prints CSV: per case the mean and 95%% confidence interval of the\n"
+            "time and throughput, and the mean CPU time of each side.\n"
+            "Aborting...\n",
+            filename, SIZE_STEP, DEF_REPEATS, DEF_DIR);
+}
+
+/* parses a byte count with an optional K/M/G suffix */
+int parse_size(const char *str, uint64_t *size) {
+    char *end;
+    unsigned long long val;
+    int shift = 0;
+
+    errno = 0;
+    val = strtoull(str, &end, 10);
+    if (errno || end == str || *str == '-')
+        return 1;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end || val > (UINT64_MAX >> shift))
+        return 1;
+    val <<= shift;
+    *size = (uint64_t)val;
+    return 0;
+}
+
+long long now_nsec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long tv_usec(struct timeval *tv) {
+    return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+/* the payload is this block repeated - byte o of the stream is buf[o % block] */
+void fill_pattern(char *buf, size_t block) {
+    size_t i;
+
+    for (i = 0; i < block; i++)
+        buf[i] = (char)(i * 7 + 1);
+}
+
+/* a word at a time - the reader's check must not be what limits it */
+uint64_t byte_sum(const char *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *)buf;
+    const uint64_t lanes = 0x00ff00ff00ff00ffULL;
+    uint64_t sum = 0, acc, w;
+    size_t i = 0, j;
+
+    while (i + 8 <= len) {
+        //four 16-bit lanes, each gaining at most 510 a word - fold every 128 words
+        for (acc = 0, j = 0; j < 128 && i + 8 <= len; j++, i += 8) {
+            memcpy(&w, p + i, sizeof(w));
+            acc += (w & lanes) + ((w >> 8) & lanes);
+        }
+        acc = (acc & 0x0000ffff0000ffffULL) + ((acc >> 16) & 0x0000ffff0000ffffULL);
+        sum += (acc & 0xffffffff) + (acc >> 32);
+    }
+    for (; i < len; i++)
+        sum += p[i];
+    return sum;
+}
+
+/* what the reader's sum of a size byte payload must come to */
+uint64_t pattern_sum(const char *buf, size_t block, uint64_t size) {
+    return (size / block) * byte_sum(buf, block) + byte_sum(buf, (size_t)(size % block));
+}
+
+int write_all(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* byte streams: fifo, unix socket and socketpair */
+int send_fd(struct channel *ch, const char *buf, size_t block, uint64_t size) {
+    uint64_t off;
+    size_t n;
+
+    for (off = 0; off < size; off += n) {
+        n = (size_t)MIN(size - off, (uint64_t)block);
+        if (write_all(ch->fd, buf, n)) {
+            fprintf(stderr, "ERROR: Failed to write to [%s]\n"
+                    "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int recv_fd(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum) {
+    uint64_t got = 0;
+    ssize_t n;
+
+    while (got < size) {
+        n = read(ch->fd, buf, (size_t)MIN(size - got, (uint64_t)block));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (!n)             //the writer went away early
+                errno = ENODATA;
+            fprintf(stderr, "ERROR: Failed to read from [%s]\n"
+                    "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+            return 1;
+        }
+        *sum += byte_sum(buf, (size_t)n);
+        got += (uint64_t)n;
+    }
+    return 0;
+}
+
+int fifo_setup(struct channel *ch) {
+    snprintf(ch->path, sizeof(ch->path), "%s/ipc_bench.%d.fifo", opts.dir, getpid());
+    unlink(ch->path);
+    if (mkfifo(ch->path, PERMISSIONS)) {
+        fprintf(stderr, "ERROR: Failed to create fifo file [%s]\n"
+                "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+        return 1;
+    }
+    return 0;
+}
+
+int fifo_open(struct channel *ch, enum role role) {
+    //each open blocks until the other side opens too
+    ch->fd = open(ch->path, role == WRITER ? O_WRONLY : O_RDONLY);
+    return ch->fd < 0;
+}
+
+void path_teardown(struct channel *ch) {
+    unlink(ch->path);
+}
+
+/* mmap: the writer fills a shared file mapping, then tells the reader
+ * (through a pipe) that it may map and read it */
+int mmap_setup(struct channel *ch) {
+    snprintf(ch->path, sizeof(ch->path), "%s/ipc_bench.%d.mmap", opts.dir, getpid());
+    if (pipe(ch->fds)) {
+        fprintf(stderr, "ERROR: Failed to create pipe\n"
+                "Cause: %s [%d]\n", strerror(errno), errno);
+        return 1;
+    }
+    return 0;
+}
+
+int mmap_open(struct channel *ch, enum role role) {
+    close(ch->fds[role == WRITER ? 0 : 1]);
+    ch->fd = open(ch->path, O_RDWR | O_CREAT, PERMISSIONS);
+    return ch->fd < 0;
+}
+
+int mmap_send(struct channel *ch, const char *buf, size_t block, uint64_t size) {
+    uint64_t off;
+    size_t n;
+    char *map;
+
+    if (ftruncate(ch->fd, (off_t)size)) {
+        fprintf(stderr, "ERROR: Failed to resize file [%s]\n"
+                "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+        return 1;
+    }
+    map = (char *)mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, ch->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to mmap file [%s]\n"
+                "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+        return 1;
+    }
+    for (off = 0; off < size; off += n) {
+        n = (size_t)MIN(size - off, (uint64_t)block);
+        memcpy(map + off, buf, n);
+    }
+    munmap(map, (size_t)size);
+    if (write_all(ch->fds[1], "x", 1)) {
+        fprintf(stderr, "ERROR: Failed to notify the reader\n"
+                "Cause: %s [%d]\n", strerror(errno), errno);
+        return 1;
+    }
+    return 0;
+}
+
+int mmap_recv(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum) {
+    char token;
+    char *map;
+
+    (void)buf;
+    (void)block;
+    if (read(ch->fds[0], &token, 1) != 1) {
+        fprintf(stderr, "ERROR: The writer didn't finish the mapping\n");
+        return 1;
+    }
+    map = (char *)mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, ch->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to mmap file [%s]\n"
+                "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+        return 1;
+    }
+    *sum = byte_sum(map, (size_t)size);
+    munmap(map, (size_t)size);
+    return 0;
+}
+
+void mmap_teardown(struct channel *ch) {
+    close(ch->fds[0]);
+    close(ch->fds[1]);
+    unlink(ch->path);
+}
+
+/* unix stream socket: the parent listens, so the writer can't connect early */
+int unix_setup(struct channel *ch) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(ch->path, sizeof(addr.sun_path), "%s/ipc_bench.%d.sock", opts.dir, getpid());
+    strcpy(addr.sun_path, ch->path);
+    unlink(ch->path);
+    ch->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ch->listen_fd < 0 || bind(ch->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(ch->listen_fd, 1)) {
+        fprintf(stderr, "ERROR: Failed to listen on socket [%s]\n"
+                "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+        if (ch->listen_fd >= 0)
+            close(ch->listen_fd);
+        return 1;
+    }
+    return 0;
+}
+
+int unix_open(struct channel *ch, enum role role) {
+    struct sockaddr_un addr;
+
+    if (role == READER) {
+        ch->fd = accept(ch->listen_fd, NULL, NULL);
+        return ch->fd < 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, ch->path);
+    ch->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    return ch->fd < 0 || connect(ch->fd, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+void unix_teardown(struct channel *ch) {
+    close(ch->listen_fd);
+    unlink(ch->path);
+}
+
+int pair_setup(struct channel *ch) {
+    snprintf(ch->path, sizeof(ch->path), "socketpair");
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ch->fds)) {
+        fprintf(stderr, "ERROR: Failed to create socketpair\n"
+                "Cause: %s [%d]\n", strerror(errno), errno);
+        return 1;
+    }
+    return 0;
+}
+
+int pair_open(struct channel *ch, enum role role) {
+    ch->fd = ch->fds[role == WRITER ? 0 : 1];
+    close(ch->fds[role == WRITER ? 1 : 0]);
+    return 0;
+}
+
+void pair_teardown(struct channel *ch) {
+    close(ch->fds[0]);
+    close(ch->fds[1]);
+}
+
+/* POSIX message queue: the payload in MQ_MSG_SIZE messages */
+int mq_setup(struct channel *ch) {
+    struct mq_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.mq_maxmsg = MQ_MAX_MSG;
+    attr.mq_msgsize = MQ_MSG_SIZE;
+    snprintf(ch->path, sizeof(ch->path), "/ipc_bench.%d", getpid());
+    mq_unlink(ch->path);
+    ch->mq = mq_open(ch->path, O_RDWR | O_CREAT | O_EXCL, PERMISSIONS, &attr);
+    if (ch->mq == (mqd_t)-1) {
+        fprintf(stderr, "ERROR: Failed to create message queue [%s]\n"
+                "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+        return 1;
+    }
+    return 0;
+}
+
+int mq_open_end(struct channel *ch, enum role role) {
+    (void)ch;
+    (void)role;
+    return 0;
+}
+
+int mq_send_all(struct channel *ch, const char *buf, size_t block, uint64_t size) {
+    uint64_t off;
+    size_t n;
+
+    for (off = 0; off < size; off += n) {
+        n = (size_t)MIN(size - off, (uint64_t)MQ_MSG_SIZE);
+        //walk the block, so the stream is the same as the other transports'
+        n = MIN(n, block - (size_t)(off % block));
+        //an interrupted send didn't queue the message - send it again
+        while (mq_send(ch->mq, buf + off % block, n, 0)) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ERROR: Failed to send to message queue [%s]\n"
+                    "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int mq_recv_all(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum) {
+    uint64_t got = 0;
+    ssize_t n;
+
+    (void)block;
+    while (got < size) {
+        n = mq_receive(ch->mq, buf, MQ_MSG_SIZE, NULL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fprintf(stderr, "ERROR: Failed to receive from message queue [%s]\n"
+                    "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+            return 1;
+        }
+        *sum += byte_sum(buf, (size_t)n);
+        got += (uint64_t)n;
+    }
+    return 0;
+}
+
+void mq_teardown(struct channel *ch) {
+    mq_close(ch->mq);
+    mq_unlink(ch->path);
+}
+
+/* shared-memory ring (shm_ring.c): the writer copies each block straight
+ * into the free space of the ring, the reader sums the bytes in place. a
+ * full or empty ring parks that side on a futex */
+int shm_setup(struct channel *ch) {
+    snprintf(ch->path, sizeof(ch->path), "/ipc_bench.%d", getpid());
+    ring_unlink(ch->path);
+    if (ring_create(ch->path, RING_SIZE)) {
+        fprintf(stderr, "ERROR: Failed to create shared memory ring [%s]\n"
+                "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+        return 1;
+    }
+    return 0;
+}
+
+int shm_open_end(struct channel *ch, enum role role) {
+    return ring_open(&ch->ring, ch->path, role == WRITER);
+}
+
+int shm_send(struct channel *ch, const char *buf, size_t block, uint64_t size) {
+    uint64_t off;
+    char *p;
+    size_t n;
+
+    for (off = 0; off < size; off += n) {
+        n = ring_reserve(&ch->ring, &p);
+        if (!n && errno == EINTR)
+            continue;
+        if (!n) {
+            fprintf(stderr, "ERROR: Failed to write to shared memory ring [%s]\n"
+                    "Cause: %s [%d]\n", ch->path, strerror(errno), errno);
+            return 1;
+        }
+        n = (size_t)MIN((uint64_t)n, size - off);
+        n = MIN(n, block - (size_t)(off % block));
+        memcpy(p, buf + off % block, n);
+        ring_commit(&ch->ring, n);
+    }
+    ring_close(&ch->ring);
+    return 0;
+}
+
+int shm_recv(struct channel *ch, char *buf, size_t block, uint64_t size, uint64_t *sum) {
+    const char *p;
+    uint64_t got;
+    size_t n;
+
+    (void)buf;
+    for (got = 0; got < size; got += n) {
+        n = ring_peek(&ch->ring, &p);
+        if (!n && errno == EINTR)
+            continue;
+        if (!n) {
+            fprintf(stderr, "ERROR: Shared memory ring [%s] ended after %llu bytes\n"
+                    "Cause: %s [%d]\n", ch->path, (unsigned long long)got,
+                    strerror(errno), errno);
+            return 1;
+        }
+        n = MIN(n, block);
+        *sum += byte_sum(p, n);
+        ring_consume(&ch->ring, n);
+    }
+    ring_close(&ch->ring);
+    return 0;
+}
+
+void shm_teardown(struct channel *ch) {
+    ring_unlink(ch->path);
+}
+
+/* one side of a run - it reports ready, then its result, on up_fd.
+ * never returns */
+void child(const struct transport *t, struct channel *ch, enum role role, uint64_t size,
+           int up_fd, int go_fd) {
+    struct side_result res;
+    struct rusage before, after;
+    char *buf = NULL, go;
+
+    memset(&res, 0, sizeof(res));
+    res.role = role;
+    signal(SIGPIPE, SIG_IGN);           //a reader that died shows up as EPIPE
+    //mq_receive() wants room for a whole message, whatever the block
+    buf = (char *) malloc (role == READER ? MAX(opts.block, MQ_MSG_SIZE) : opts.block);
+    if (!buf || t->open(ch, role)) {
+        fprintf(stderr, "ERROR: Failed to open the %s end of [%s]\n"
+                "Cause: %s [%d]\n", role == WRITER ? "writer" : "reader",
+                t->name, strerror(errno), errno);
+        res.rc = 1;
+        goto report;
+    }
+    if (role == WRITER)
+        fill_pattern(buf, opts.block);
+    if (write_all(up_fd, "r", 1) || read(go_fd, &go, 1) != 1) {
+        res.rc = 1;
+        goto report;
+    }
+
+    getrusage(RUSAGE_SELF, &before);
+    res.start_ns = now_nsec();
+    if (role == WRITER)
+        res.rc = t->send(ch, buf, opts.block, size);
+    else
+        res.rc = t->recv(ch, buf, opts.block, size, &res.sum);
+    res.end_ns = now_nsec();
+    getrusage(RUSAGE_SELF, &after);
+    res.cpu_user_us = tv_usec(&after.ru_utime) - tv_usec(&before.ru_utime);
+    res.cpu_sys_us = tv_usec(&after.ru_stime) - tv_usec(&before.ru_stime);
+
+report:
+    //a failed open still reports ready, so the parent isn't left waiting
+    if (res.rc && !res.start_ns)
+        write_all(up_fd, "f", 1);
+    write_all(up_fd, (const char *)&res, sizeof(res));
+    free(buf);
+    _exit(res.rc ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+int ready_failed(const char *buf) {
+    return *buf != 'r';
+}
+
+int result_failed(const char *buf) {
+    struct side_result res;
+
+    memcpy(&res, buf, sizeof(res));
+    return res.rc;
+}
+
+/* reads len bytes from each child's pipe, in whichever order they come
+ * (len is below PIPE_BUF, so each arrives whole). returns 1 as soon as one
+ * pipe ends short of that (the child died) or failed() says it gave up -
+ * the other one may be waiting on it for good */
+int read_children(int up[2][2], char *bufs[2], size_t len, int (*failed)(const char *buf)) {
+    struct pollfd pfd[2];
+    ssize_t n;
+    int i, left = 2;
+
+    for (i = 0; i < 2; i++) {
+        pfd[i].fd = up[i][0];
+        pfd[i].events = POLLIN;
+    }
+    while (left) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        for (i = 0; i < 2; i++) {
+            if (!pfd[i].revents)
+                continue;
+            n = read(up[i][0], bufs[i], len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n != (ssize_t)len || failed(bufs[i]))
+                return 1;
+            pfd[i].fd = -1;             //done - poll() skips it
+            left--;
+        }
+    }
+    return 0;
+}
+
+/* runs one transfer of size bytes, which the reader must sum up to sum.
+ * returns 1 if it failed */
+int run_once(const struct transport *t, uint64_t size, uint64_t sum, struct run *run) {
+    struct channel ch;
+    struct side_result res[2];
+    int up[2][2] = { { -1, -1 }, { -1, -1 } }, go[2] = { -1, -1 };
+    pid_t pids[2] = { -1, -1 };
+    char ready[2], *bufs[2];
+    int i, j, rc = 1;
+
+    memset(&ch, 0, sizeof(ch));
+    memset(res, 0, sizeof(res));
+    ch.fd = ch.listen_fd = -1;
+    ch.fds[0] = ch.fds[1] = -1;
+    //a pipe up from each child, so a child that dies shows up as its EOF
+    if (pipe(up[0]) || pipe(up[1]) || pipe(go)) {
+        fprintf(stderr, "ERROR: Failed to create pipe\n"
+                "Cause: %s [%d]\n", strerror(errno), errno);
+        goto close_pipes;
+    }
+    if (t->setup(&ch))
+        goto close_pipes;
+
+    for (i = 0; i < 2; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            fprintf(stderr, "ERROR: Failed to fork\n"
+                    "Cause: %s [%d]\n", strerror(errno), errno);
+            goto cleanup;
+        }
+        if (!pids[i]) {
+            for (j = 0; j < 2; j++) {
+                close(up[j][0]);
+                if (j != i)
+                    close(up[j][1]);
+            }
+            close(go[1]);
+            child(t, &ch, i ? READER : WRITER, size, up[i][1], go[0]);
+        }
+    }
+    //only the children may hold the write ends, or their EOF never comes
+    for (i = 0; i < 2; i++) {
+        close(up[i][1]);
+        up[i][1] = -1;
+    }
+    close(go[0]);
+    go[0] = -1;
+
+    //both ends are up (or one failed) - start them together
+    bufs[0] = &ready[0];
+    bufs[1] = &ready[1];
+    if (read_children(up, bufs, 1, ready_failed))
+        goto cleanup;
+    if (write_all(go[1], "gg", 2))
+        goto cleanup;
+
+    //a failed or dead side fails the run - the other one may be stuck, it's killed
+    bufs[0] = (char *)&res[0];
+    bufs[1] = (char *)&res[1];
+    if (read_children(up, bufs, sizeof(res[0]), result_failed))
+        goto cleanup;
+    if (res[0].role != WRITER || res[1].role != READER)
+        goto cleanup;
+    if (res[1].sum != sum) {
+        fprintf(stderr, "ERROR: The reader got corrupt data over [%s]\n", t->name);
+        goto cleanup;
+    }
+    run->sec = (double)(res[1].end_ns - res[0].start_ns) / 1e9;
+    run->writer_user_ms = (double)res[0].cpu_user_us / 1000.0;
+    run->writer_sys_ms = (double)res[0].cpu_sys_us / 1000.0;
+    run->reader_user_ms = (double)res[1].cpu_user_us / 1000.0;
+    run->reader_sys_ms = (double)res[1].cpu_sys_us / 1000.0;
+    rc = 0;
+
+cleanup:
+    for (i = 0; i < 2; i++) {
+        if (pids[i] <= 0)
+            continue;
+        if (rc)
+            kill(pids[i], SIGKILL);
+        waitpid(pids[i], NULL, 0);
+    }
+    t->teardown(&ch);
+close_pipes:
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++)
+            if (up[i][j] >= 0)
+                close(up[i][j]);
+        if (go[i] >= 0)
+            close(go[i]);
+    }
+    return rc;
+}
+
+/* mean and half-width of its 95% confidence interval (Student's t) */
+void mean_ci(const double *v, int n, double *mean, double *ci) {
+    static const double t95[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    double var = 0;
+    int i, df = n - 1;
+
+    *mean = 0;
+    for (i = 0; i < n; i++)
+        *mean += v[i];
+    *mean /= n;
+    if (n < 2) {
+        *ci = 0;
+        return;
+    }
+    for (i = 0; i < n; i++)
+        var += (v[i] - *mean) * (v[i] - *mean);
+    var /= df;
+    *ci = (df < (int)(sizeof(t95) / sizeof(t95[0])) ? t95[df] : 1.960) * sqrt(var / n);
+}
+
+/* runs one transport at one size opts.repeats times and prints its row.
+ * returns 1 if a run failed */
+int bench_case(const struct transport *t, uint64_t size, uint64_t sum) {
+    static struct run runs[MAX_RUNS];
+    static double sec[MAX_RUNS], mibs[MAX_RUNS];
+    double sec_mean, sec_ci, mibs_mean, mibs_ci;
+    double wu = 0, ws = 0, ru = 0, rs = 0;
+    int i;
+
+    for (i = 0; i < opts.repeats; i++) {
+        if (run_once(t, size, sum, &runs[i])) {
+            fprintf(stderr, "ERROR: Run %d of [%s] with %llu bytes failed\n",
+                    i + 1, t->name, (unsigned long long)size);
+            return 1;
+        }
+        sec[i] = runs[i].sec;
+        mibs[i] = (double)size / (1024.0 * 1024.0) / runs[i].sec;
+        wu += runs[i].writer_user_ms;
+        ws += runs[i].writer_sys_ms;
+        ru += runs[i].reader_user_ms;
+        rs += runs[i].reader_sys_ms;
+    }
+    mean_ci(sec, opts.repeats, &sec_mean, &sec_ci);
+    mean_ci(mibs, opts.repeats, &mibs_mean, &mibs_ci);
+    printf("%s,%llu,%d,%.9f,%.9f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+           t->name, (unsigned long long)size, opts.repeats,
+           sec_mean, sec_ci, mibs_mean, mibs_ci,
+           wu / opts.repeats, ws / opts.repeats, ru / opts.repeats, rs / opts.repeats);
+    fflush(stdout);
+    return 0;
+}
+
+int selected(const char *name) {
+    const char *p = opts.transports;
+    size_t len = strlen(name);
+
+    if (!p)
+        return 1;
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == opts.transports || p[-1] == ',') && (p[len] == ',' || !p[len]))
+            return 1;
+        p += len;
+    }
+    return 0;
+}
+
+int main ( int argc, char *argv[]) {
+
+    char *pattern = NULL, *name;
+    uint64_t size, block;
+    int i, c, rc = 0, found;
+
+    while ((c = getopt(argc, argv, "t:m:M:n:b:d:")) != -1) {
+        switch (c) {
+        case 't':
+            opts.transports = optarg;
+            break;
+        case 'm':
+        case 'M':
+            if (parse_size(optarg, c == 'm' ? &opts.min : &opts.max) ||
+                !(c == 'm' ? opts.min : opts.max)) {
+                fprintf(stderr, "ERROR: Invalid payload size [%s]\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            opts.repeats = (int)strtol(optarg, NULL, 10);
+            if (opts.repeats < 1 || opts.repeats > MAX_RUNS) {
+                fprintf(stderr, "ERROR: Invalid number of runs [%s]\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b':
+            if (parse_size(optarg, &block) || !block || block > (1ULL << 30)) {
+                fprintf(stderr, "ERROR: Invalid block size [%s]\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.block = (size_t)block;
+            break;
+        case 'd':
+            opts.dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || opts.min > opts.max) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    //every name of -t must be a transport
+    for (name = opts.transports ? strtok(strdup(opts.transports), ",") : NULL;
+         name; name = strtok(NULL, ",")) {
+        for (found = 0, i = 0; i < transports_num; i++)
+            found |= !strcmp(name, transports[i].name);
+        if (!found) {
+            fprintf(stderr, "ERROR: Unknown transport [%s]\n", name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    pattern = (char *) malloc (opts.block);
+    if (!pattern) {
+        fprintf(stderr, "ERROR: Failed to allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    fill_pattern(pattern, opts.block);
+    //a go sent to children that already died shows up as EPIPE, and a
+    //file over RLIMIT_FSIZE as EFBIG rather than a kill
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGXFSZ, SIG_IGN);
+
+    printf("transport,bytes,runs,sec_mean,sec_ci95,mib_s_mean,mib_s_ci95,"
+           "writer_user_ms,writer_sys_ms,reader_user_ms,reader_sys_ms\n");
+    for (size = opts.min; size <= opts.max; size *= SIZE_STEP) {
+        for (i = 0; i < transports_num; i++)
+            if (selected(transports[i].name))
+                rc |= bench_case(&transports[i], size,
+                                 pattern_sum(pattern, opts.block, size));
+        if (size > opts.max / SIZE_STEP)
+            break;
+    }
+
+    free(pattern);
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include<sys/types.h>
+#include <sys/time.h>
+#include<unistd.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include <signal.h>
+#include "shm_ring.h"
+
+#define RING_NAME       "/osring"
+#define OPEN_TRIES      500             //10ms apart - the writer may not have created it yet
+
+/*
+ * shm_reader: consumes shm_writer's stream while it's being written, until
+ * the writer ends it (or a SIGINT stops it while it waits for data). counts
+ * the 'a's it got, or with '-' copies the bytes to stdout instead (and
+ * reports on stderr):
+ *
+ *   shm_reader
+ *   shm_reader - > out
+ */
+
+volatile sig_atomic_t stop;
+
+void usage(char* filename);
+static void on_sigint(int sig);
+int write_all(int fd, const char *buf, size_t len);
+
+void usage(char* filename) {
+    printf("Usage: %s [-]\n"
+           "Aborting...\n",
+            filename);
+}
+
+static void on_sigint(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+int write_all(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return 1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int main ( int argc, char *argv[]) {
+
+    //validate command line arguments
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-"))) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    //declerations:
+    const char *p;
+    int     i, rc, to_stdout = argc == 2;
+    double  elapsed_msec;
+    size_t  j, n, actual_rsize, a_count;
+    struct  timeval t1, t2;
+    struct  ring ring;
+    struct  sigaction sa;
+    memset(&sa, 0, sizeof(struct sigaction));
+
+    //SIGINT stops the wait for data - data already there is still read
+    sa.sa_handler = on_sigint;
+    rc = sigaction(SIGINT, &sa, NULL);
+    if (rc) {
+        printf("ERROR: Failed to create sigaction\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        return -1;
+    }
+
+    //attach, waiting for the writer to create the ring
+    for (i = 0; (rc = ring_open(&ring, RING_NAME, 0)); i++) {
+        if ((errno != ENOENT && errno != EAGAIN) || i == OPEN_TRIES)
+            break;
+        if (stop) {
+            errno = EINTR;
+            break;
+        }
+        usleep(10000);
+    }
+    if (rc) {
+        printf("ERROR: Failed to open shared memory ring [%s]\n"
+               "Cause: %s [%d]\n",
+               RING_NAME, strerror(errno), errno);
+        return -1;
+    }
+    //both sides are mapped - the name isn't needed anymore
+    ring_unlink(RING_NAME);
+    ring.stop = &stop;
+
+    //start measurements
+    rc = gettimeofday(&t1, NULL);
+    if (rc) {
+       printf("ERROR: Failed to measure time\n"
+              "Cause: %s [%d]\n",
+              strerror(errno), errno);
+        goto cleanup;
+    }
+
+    //read in place, until the writer ends the stream (or SIGINT while waiting)
+    actual_rsize = a_count = 0;
+    for (;;) {
+        n = ring_peek(&ring, &p);
+        if (!n && errno == EINTR && !stop)
+            continue;
+        if (!n)
+            break;
+        if (!to_stdout) {
+            for (j = 0; j < n; j++)
+                a_count += p[j] == 'a';
+        } else if (write_all(STDOUT_FILENO, p, n)) {
+            fprintf(stderr, "ERROR: Failed to write to stdout\n"
+                    "Cause: %s [%d]\n",
+                    strerror(errno), errno);
+            rc = -1;
+            goto cleanup;
+        }
+        ring_consume(&ring, n);
+        actual_rsize += n;
+    }
+    if (errno && errno != EINTR) {
+        fprintf(to_stdout ? stderr : stdout,
+                "ERROR: The writer died after %lu bytes\n"
+                "Cause: %s [%d]\n",
+                actual_rsize, strerror(errno), errno);
+        rc = -1;
+        goto cleanup;
+    }
+
+    //finish time measurement
+    rc = gettimeofday(&t2, NULL);
+    if (rc) {
+       printf("ERROR: Failed to measure time\n"
+              "Cause: %s [%d]\n",
+              strerror(errno), errno);
+        goto cleanup;
+    }
+    elapsed_msec = (t2.tv_sec - t1.tv_sec) * 1000.0;
+    elapsed_msec += (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+    //print results
+    fprintf(to_stdout ? stderr : stdout,
+            "%lu bytes were read in %f miliseconds through SHM ring\n",
+            to_stdout ? actual_rsize : a_count, elapsed_msec);
+
+cleanup:
+    ring_close(&ring);
+    return rc;
+}
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<signal.h>
+#include<string.h>
+#include<time.h>
+#include<limits.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
+#include "shm_ring.h"
+
+#define SPIN_TRIES      256             //polls before parking - with a CPU to spare
+#define PARK_NSEC       1000000         //how often a parked side checks its peer and *stop
+#define PERMISSIONS     0600
+
+static void cpu_relax(void);
+static int futex_wait(_Atomic unsigned *addr, unsigned val);
+static void futex_wake(_Atomic unsigned *addr);
+static int peer_gone(_Atomic pid_t *pid);
+static int ring_wait(struct ring *r, _Atomic unsigned *idx, unsigned val,
+                     _Atomic int *parked, _Atomic int *closed, _Atomic pid_t *peer,
+                     int *spins);
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+//not FUTEX_*_PRIVATE - the word is shared between processes
+static int futex_wait(_Atomic unsigned *addr, unsigned val) {
+    struct timespec ts = { 0, PARK_NSEC };
+    return (int)syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void futex_wake(_Atomic unsigned *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* the other side opened the ring and has exited since (0: not opened yet) */
+static int peer_gone(_Atomic pid_t *pid) {
+    pid_t p = atomic_load_explicit(pid, memory_order_relaxed);
+
+    return p && kill(p, 0) && errno == ESRCH;
+}
+
+/* one round of waiting for *idx to move from val: a pause while spinning,
+ * then a park. returns EPIPE if the peer died meanwhile, EINTR once *stop
+ * is set, 0 otherwise */
+static int ring_wait(struct ring *r, _Atomic unsigned *idx, unsigned val,
+                     _Atomic int *parked, _Atomic int *closed, _Atomic pid_t *peer,
+                     int *spins) {
+    int err = 0;
+
+    //the kernel may restart an interrupted futex wait - EINTR alone isn't enough
+    if (r->stop && *r->stop)
+        return EINTR;
+    if ((*spins)++ < r->spin) {
+        cpu_relax();
+        return 0;
+    }
+    //seq_cst pairs with the store-then-check in ring_commit/consume/close
+    atomic_store(parked, 1);
+    if (atomic_load(idx) == val && !atomic_load(closed) && futex_wait(idx, val)) {
+        if (errno == EINTR)
+            err = EINTR;
+        else if (errno == ETIMEDOUT && peer_gone(peer))
+            err = EPIPE;
+    }
+    atomic_store(parked, 0);
+    return err;
+}
+
+int ring_create(const char *name, size_t size) {
+    struct shm_ring *shm;
+    size_t map_size = sizeof(struct shm_ring) + size;
+    int fd, err;
+
+    if (!size || size > RING_MAX_SIZE || (size & (size - 1))) {
+        errno = EINVAL;
+        return 1;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, PERMISSIONS);
+    if (fd < 0)
+        return 1;
+    if (ftruncate(fd, (off_t)map_size))
+        goto fail;
+    shm = (struct shm_ring *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        goto fail;
+    close(fd);
+
+    //the object comes zeroed - only size and magic left, magic last for ring_open()
+    shm->size = (unsigned)size;
+    atomic_store_explicit(&shm->magic, RING_MAGIC, memory_order_release);
+    munmap(shm, map_size);
+    return 0;
+
+fail:
+    err = errno;
+    close(fd);
+    shm_unlink(name);
+    errno = err;
+    return 1;
+}
+
+int ring_open(struct ring *r, const char *name, int writer) {
+    struct shm_ring *shm;
+    struct stat st;
+    int fd, err;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &st))
+        goto fail;
+    //a ring_create() that hasn't sized it yet
+    if ((size_t)st.st_size < sizeof(struct shm_ring)) {
+        errno = EAGAIN;
+        goto fail;
+    }
+    //prefaulted - a stream shouldn't pay for the ring's pages as it first wraps
+    shm = (struct shm_ring *)mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (shm == MAP_FAILED)
+        goto fail;
+    close(fd);
+
+    if (atomic_load_explicit(&shm->magic, memory_order_acquire) != RING_MAGIC) {
+        munmap(shm, (size_t)st.st_size);
+        errno = EAGAIN;
+        return 1;
+    }
+    if (sizeof(struct shm_ring) + shm->size != (size_t)st.st_size) {
+        munmap(shm, (size_t)st.st_size);
+        errno = EINVAL;
+        return 1;
+    }
+
+    r->shm = shm;
+    r->map_size = (size_t)st.st_size;
+    r->writer = writer;
+    //on a single CPU the other side can't move while this one spins
+    r->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_TRIES : 0;
+    r->stop = NULL;
+    if (writer) {
+        r->cached = atomic_load_explicit(&shm->tail, memory_order_acquire);
+        atomic_store(&shm->writer_pid, getpid());
+    } else {
+        r->cached = atomic_load_explicit(&shm->head, memory_order_acquire);
+        atomic_store(&shm->reader_pid, getpid());
+    }
+    return 0;
+
+fail:
+    err = errno;
+    close(fd);
+    errno = err;
+    return 1;
+}
+
+size_t ring_reserve(struct ring *r, char **p) {
+    struct shm_ring *shm = r->shm;
+    unsigned head = atomic_load_explicit(&shm->head, memory_order_relaxed);
+    unsigned size = shm->size, at;
+    size_t n;
+    int err, spins = 0;
+
+    //the cached tail only ever lags - the tail line is touched when it looks full
+    while (head - r->cached == size) {
+        r->cached = atomic_load_explicit(&shm->tail, memory_order_acquire);
+        if (head - r->cached != size)
+            break;
+        if (atomic_load_explicit(&shm->reader_closed, memory_order_relaxed)) {
+            errno = EPIPE;
+            return 0;
+        }
+        err = ring_wait(r, &shm->tail, r->cached, &shm->writer_parked,
+                        &shm->reader_closed, &shm->reader_pid, &spins);
+        if (err) {
+            errno = err;
+            return 0;
+        }
+    }
+    at = head & (size - 1);
+    n = size - (head - r->cached);
+    if (n > size - at)
+        n = size - at;
+    *p = shm->data + at;
+    return n;
+}
+
+void ring_commit(struct ring *r, size_t n) {
+    struct shm_ring *shm = r->shm;
+    unsigned head = atomic_load_explicit(&shm->head, memory_order_relaxed);
+
+    //seq_cst pairs with the reader's parked/head check in ring_wait()
+    atomic_store(&shm->head, head + (unsigned)n);
+    if (atomic_load(&shm->reader_parked))
+        futex_wake(&shm->head);
+}
+
+size_t ring_peek(struct ring *r, const char **p) {
+    struct shm_ring *shm = r->shm;
+    unsigned tail = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+    unsigned size = shm->size, at;
+    size_t n;
+    int err, spins = 0;
+
+    while (r->cached == tail) {
+        r->cached = atomic_load_explicit(&shm->head, memory_order_acquire);
+        if (r->cached != tail)
+            break;
+        //the writer publishes its last head before closing
+        if (atomic_load_explicit(&shm->writer_closed, memory_order_acquire)) {
+            r->cached = atomic_load_explicit(&shm->head, memory_order_relaxed);
+            if (r->cached != tail)
+                break;
+            errno = 0;
+            return 0;
+        }
+        err = ring_wait(r, &shm->head, tail, &shm->reader_parked,
+                        &shm->writer_closed, &shm->writer_pid, &spins);
+        if (err) {
+            errno = err;
+            return 0;
+        }
+    }
+    at = tail & (size - 1);
+    n = r->cached - tail;
+    if (n > size - at)
+        n = size - at;
+    *p = shm->data + at;
+    return n;
+}
+
+void ring_consume(struct ring *r, size_t n) {
+    struct shm_ring *shm = r->shm;
+    unsigned tail = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+
+    //seq_cst pairs with the writer's parked/tail check in ring_wait()
+    atomic_store(&shm->tail, tail + (unsigned)n);
+    if (atomic_load(&shm->writer_parked))
+        futex_wake(&shm->tail);
+}
+
+int ring_write(struct ring *r, const void *buf, size_t len) {
+    const char *src = (const char *)buf;
+    char *p;
+    size_t n;
+
+    while (len > 0) {
+        n = ring_reserve(r, &p);
+        if (!n)
+            return 1;
+        if (n > len)
+            n = len;
+        memcpy(p, src, n);
+        ring_commit(r, n);
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+size_t ring_read(struct ring *r, void *buf, size_t len) {
+    const char *p;
+    size_t n;
+
+    n = ring_peek(r, &p);
+    if (!n)
+        return 0;
+    if (n > len)
+        n = len;
+    memcpy(buf, p, n);
+    ring_consume(r, n);
+    return n;
+}
+
+void ring_close(struct ring *r) {
+    struct shm_ring *shm = r->shm;
+
+    if (r->writer) {
+        atomic_store(&shm->writer_closed, 1);
+        if (atomic_load(&shm->reader_parked))
+            futex_wake(&shm->head);
+    } else {
+        atomic_store(&shm->reader_closed, 1);
+        if (atomic_load(&shm->writer_parked))
+            futex_wake(&shm->tail);
+    }
+    munmap(shm, r->map_size);
+    r->shm = NULL;
+}
+
+int ring_unlink(const char *name) {
+    return shm_unlink(name) ? 1 : 0;
+}
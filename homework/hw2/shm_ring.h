@@ -0,0 +1,97 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include<sys/types.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<stdatomic.h>
+#include<signal.h>
+
+#define RING_MAGIC      0x31474e49524d4853ULL   //"SHMRING1"
+#define RING_MAX_SIZE   (1U << 30)      //indices wrap at 2^32 - the ring must stay below
+#define RING_LINE       64
+
+/*
+ * lock-free single-producer/single-consumer byte ring in POSIX shared memory,
+ * for a stream between two processes. head and tail count bytes (mod 2^32),
+ * each written by one side only and kept on its own cache line, so the fast
+ * path is an acquire load of the other side's index and a release store of
+ * one's own. a full ring parks the writer and an empty one parks the reader
+ * on a futex, after a short spin - that is the backpressure. a side that
+ * dies without ring_close() is noticed through its pid.
+ */
+struct shm_ring {
+    //written by the reader
+    _Atomic unsigned tail;              //bytes consumed
+    _Atomic int      writer_parked;     //writer is (about to be) asleep on tail
+    _Atomic int      reader_closed;
+    _Atomic pid_t    reader_pid;
+    char pad1[RING_LINE - 3 * sizeof(int) - sizeof(pid_t)];
+
+    //written by the writer
+    _Atomic unsigned head;              //bytes produced
+    _Atomic int      reader_parked;     //reader is (about to be) asleep on head
+    _Atomic int      writer_closed;     //end of stream
+    _Atomic pid_t    writer_pid;
+    char pad2[RING_LINE - 3 * sizeof(int) - sizeof(pid_t)];
+
+    //set once by ring_create() - magic last
+    _Atomic uint64_t magic;
+    unsigned size;                      //data bytes, a power of two
+    char pad3[RING_LINE - sizeof(uint64_t) - sizeof(unsigned)];
+
+    char     data[];
+};
+
+/* one process's end of a ring */
+struct ring {
+    struct shm_ring *shm;
+    size_t   map_size;
+    int      writer;                    //this end produces
+    unsigned cached;                    //the other side's index, as last seen
+    int      spin;                      //polls before parking
+    const volatile sig_atomic_t *stop;  //set by a signal handler - waits give up (or NULL)
+};
+
+/*creates the shared memory object name (e.g. "/feed") with size data bytes
+ *(a power of two). returns 1 on failure, with errno set*/
+int ring_create(const char *name, size_t size);
+
+/*maps the ring name as its writer or its reader, with no stop flag.
+ *returns 1 on failure - errno EAGAIN if ring_create() hasn't finished
+ *setting it up yet*/
+int ring_open(struct ring *r, const char *name, int writer);
+
+/*writer: waits for free space, and points *p at up to the returned count of
+ *contiguous free bytes. returns 0 with errno EPIPE once the reader has gone,
+ *or EINTR if it was waiting when *r->stop got set*/
+size_t ring_reserve(struct ring *r, char **p);
+
+/*writer: publishes n of the reserved bytes*/
+void ring_commit(struct ring *r, size_t n);
+
+/*reader: waits for data, and points *p at up to the returned count of
+ *contiguous bytes. returns 0 at the end of the stream - errno EPIPE if the
+ *writer died without closing it, 0 otherwise - or with errno EINTR if it
+ *was waiting when *r->stop got set*/
+size_t ring_peek(struct ring *r, const char **p);
+
+/*reader: releases n of the peeked bytes to the writer*/
+void ring_consume(struct ring *r, size_t n);
+
+/*copies all of buf in. returns 1 as ring_reserve() fails (some of buf
+ *may be in by then)*/
+int ring_write(struct ring *r, const void *buf, size_t len);
+
+/*copies out up to len bytes, at least one. returns 0 at the end of the
+ *stream, as ring_peek()*/
+size_t ring_read(struct ring *r, void *buf, size_t len);
+
+/*ends this side (the writer's close is the end of the stream), wakes the
+ *other one and unmaps the ring*/
+void ring_close(struct ring *r);
+
+/*removes the name - the ring lives on until both sides closed it*/
+int ring_unlink(const char *name);
+
+#endif
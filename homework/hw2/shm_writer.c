@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include<sys/types.h>
+#include <sys/time.h>
+#include<unistd.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include <signal.h>
+#include "shm_ring.h"
+
+#define RING_NAME       "/osring"
+#define RING_SIZE       (1024 * 1024)
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+/*
+ * shm_writer: streams into a shared memory ring that shm_reader consumes
+ * at the same time. a full ring blocks the writer until the reader catches
+ * up, so the stream can be longer than the ring - or unbounded:
+ *
+ *   shm_writer <file_size>     file_size 'a's
+ *   shm_writer 0               'a's until SIGINT
+ *   shm_writer -               stdin until EOF (or SIGINT)
+ */
+
+volatile sig_atomic_t stop;
+
+void usage(char* filename);
+static void on_sigint(int sig);
+
+void usage(char* filename) {
+    printf("Usage: %s <%s>\n"
+           "(0 streams until SIGINT, '-' streams stdin)\n"
+           "Aborting...\n",
+            filename,
+            "file_size");
+}
+
+static void on_sigint(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+int main ( int argc, char *argv[]) {
+
+    //validate 1 command line argument given
+    if (argc != 2) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    //declerations:
+    char    *end_ptr, *p;
+    int     rc, from_stdin;
+    double  elapsed_msec;
+    size_t  n, size, actual_wsize;
+    ssize_t b_read;
+    struct  timeval t1, t2;
+    struct  ring ring;
+    struct  sigaction sa;
+    memset(&sa, 0, sizeof(struct sigaction));
+
+    //validate file size
+    from_stdin = !strcmp(argv[1], "-");
+    size = 0;
+    if (!from_stdin) {
+        errno = 0;
+        size = (size_t)strtoull(argv[1], &end_ptr, 10);
+        if (errno || *end_ptr || end_ptr == argv[1] || argv[1][0] == '-') {
+            printf("ERROR: Invalid file size: [%s]\n", argv[1]);
+            return -1;
+        }
+    }
+
+    //SIGINT ends the stream instead of the process - the reader gets a clean end
+    sa.sa_handler = on_sigint;
+    rc = sigaction(SIGINT, &sa, NULL);
+    if (rc) {
+        printf("ERROR: Failed to create sigaction\n"
+               "Cause: %s [%d]\n",
+               strerror(errno), errno);
+        return -1;
+    }
+
+    //create the ring (over a stale one of an earlier run)
+    ring_unlink(RING_NAME);
+    rc = ring_create(RING_NAME, RING_SIZE) || ring_open(&ring, RING_NAME, 1);
+    if (rc) {
+        printf("ERROR: Failed to create shared memory ring [%s]\n"
+               "Cause: %s [%d]\n",
+               RING_NAME, strerror(errno), errno);
+        ring_unlink(RING_NAME);
+        return -1;
+    }
+    ring.stop = &stop;
+
+    //start measurements
+    rc = gettimeofday(&t1, NULL);
+    if (rc) {
+       printf("ERROR: Failed to measure time\n"
+              "Cause: %s [%d]\n",
+              strerror(errno), errno);
+        goto cleanup;
+    }
+
+    //write straight into the ring's free space
+    actual_wsize = 0;
+    while (!stop && (!size || actual_wsize < size)) {
+        n = ring_reserve(&ring, &p);
+        //a SIGINT while the ring was full - the loop checks stop
+        if (!n && errno == EINTR)
+            continue;
+        if (!n) {
+            printf("ERROR: Failed to write to shared memory ring [%s]\n"
+                   "Cause: %s [%d]\n",
+                   RING_NAME, strerror(errno), errno);
+            rc = -1;
+            goto cleanup;
+        }
+        if (from_stdin) {
+            b_read = read(STDIN_FILENO, p, n);
+            if (b_read < 0 && errno == EINTR)
+                continue;
+            if (b_read < 0) {
+                printf("ERROR: Failed to read from stdin\n"
+                       "Cause: %s [%d]\n",
+                       strerror(errno), errno);
+                rc = -1;
+                goto cleanup;
+            }
+            if (!b_read)
+                break;
+            n = (size_t)b_read;
+        } else {
+            if (size)
+                n = MIN(n, size - actual_wsize);
+            memset(p, 'a', n);
+        }
+        ring_commit(&ring, n);
+        actual_wsize += n;
+    }
+
+    //finish time measurement
+    rc = gettimeofday(&t2, NULL);
+    if (rc) {
+       printf("ERROR: Failed to measure time\n"
+              "Cause: %s [%d]\n",
+              strerror(errno), errno);
+        goto cleanup;
+    }
+    elapsed_msec = (t2.tv_sec - t1.tv_sec) * 1000.0;
+    elapsed_msec += (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+    //print results
+    printf("%lu bytes were written in %f miliseconds through SHM ring\n",
+           actual_wsize, elapsed_msec);
+
+cleanup:
+    //the end of the stream - the reader unlinks the name once it attached
+    ring_close(&ring);
+    return rc;
+}